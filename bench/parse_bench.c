@@ -0,0 +1,91 @@
+/*
+parse_bench
+Measures how fast smallsh tokenizes, expands and parses command lines from a corpus.
+expand_corpus.txt holds lines dominated by variable expansions.
+smallsh.c is compiled into this program with its main() renamed.
+
+Build: gcc --std=c99 -O2 -o parse_bench parse_bench.c
+Usage: ./parse_bench [corpus file] [passes]
+Output: CSV line of lines,bytes,seconds,lines_per_sec,mb_per_sec
+*/
+
+#define main smallsh_main
+#include "../smallsh.c"
+#undef main
+
+// Returns current monotonic time in seconds
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+int main(int argc, char *argv[])
+{
+    char *corpusPath = argc > 1 ? argv[1] : "corpus.txt";
+    int passes = argc > 2 ? atoi(argv[2]) : 20000;
+    int pass;
+
+    // Loads the corpus through the same reader smallsh uses for scripts
+    struct inputSource corpus;
+    if (openScript(&corpus, corpusPath) == -1)
+    {
+        return 1;
+    }
+    char **lines = NULL;
+    size_t *lengths = NULL;
+    int lineCount = 0;
+    size_t bytes = 0;
+    size_t len;
+    char *line;
+    while ((line = readLine(&corpus, &len)) != NULL)
+    {
+        lines = realloc(lines, (lineCount + 1) * sizeof(char *));
+        lengths = realloc(lengths, (lineCount + 1) * sizeof(size_t));
+        lines[lineCount] = strndup(line, len);
+        lengths[lineCount] = len;
+        bytes += len;
+        lineCount += 1;
+    }
+
+    // Formats $$ and imports the environment as smallsh does at startup, with command substitutions
+    // turned off so they are parsed but not run
+    sprintf(shellPidString, "%d", (int)getpid());
+    importEnvironment();
+    substitutionsEnabled = 0;
+
+    // Parses every line once per pass into a fresh arena, as the prompt loop does
+    int parsed = 0;
+    double start = now();
+    for (pass = 0; pass < passes; pass++)
+    {
+        int i;
+        for (i = 0; i < lineCount; i++)
+        {
+            // Checks the list and expands its first pipeline, then expands the others as they would be
+            // just before running
+            arenaReset(&lineArena);
+            struct commandList *commandList = createCommandList(lines[i]);
+            struct commandList *element;
+            int complete = commandList != NULL;
+            for (element = commandList; element != NULL; element = element->next)
+            {
+                size_t pos = element->start;
+                struct token tok;
+                if (element->pipeline == NULL && createCommand(lines[i], &pos, &tok, 1) == NULL)
+                {
+                    complete = 0;
+                }
+            }
+            parsed += complete;
+        }
+    }
+    double elapsed = now() - start;
+
+    double totalLines = (double)lineCount * passes;
+    printf("lines,bytes,seconds,lines_per_sec,mb_per_sec\n");
+    printf("%.0f,%.0f,%.4f,%.0f,%.1f\n", totalLines, (double)bytes * passes, elapsed,
+        totalLines / elapsed, bytes * (double)passes / elapsed / 1e6);
+    return parsed == lineCount * passes ? 0 : 1;
+};
@@ -0,0 +1,671 @@
+/*
+shell_bench
+Drives a smallsh binary end to end and measures:
+- commands/sec for builtins, in-process echo and test, /bin/true, redirection-heavy lines, here-documents and background bursts,
+  with the script written to smallsh through a pipe
+- keystroke-to-prompt latency, with smallsh running interactively on a pseudo-terminal
+
+With --check it runs regression checks through the same pipe and pseudo-terminal harnesses instead:
+- the output of builtins, every argument/redirection/background combination and exit statuses
+- that smallsh's VmRSS stays flat while it runs hundreds of thousands of lines
+
+Build: gcc --std=c99 -O2 -o shell_bench shell_bench.c
+Usage: ./shell_bench [smallsh binary] [iterations] or ./shell_bench --check [smallsh binary]
+Output: CSV lines of harness,scenario,iterations,seconds,ops_per_sec,p50_us,p99_us
+(the percentiles are only given for latency scenarios), or one ok/FAIL line per check
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <limits.h>
+
+char *shellPath = "../smallsh";
+
+// Returns current monotonic time in seconds
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+// Writes all of a buffer, retrying short writes
+void writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            perror("write()");
+            exit(2);
+        }
+        data += written;
+        length -= written;
+    }
+};
+
+// Runs smallsh on a script fed through a pipe, line repeated iterations times and followed by tail,
+// and prints the throughput of the repeated line
+void runPipe(char *scenario, char *line, char *tail, int iterations)
+{
+    int input[2];
+    if (pipe(input) == -1)
+    {
+        perror("pipe()");
+        exit(2);
+    }
+
+    // Builds the whole script up front so writing it costs as little as possible while timed
+    size_t lineLength = strlen(line);
+    size_t scriptLength = lineLength * iterations + strlen(tail);
+    char *script = malloc(scriptLength + 1);
+    int i;
+    for (i = 0; i < iterations; i++)
+    {
+        memcpy(script + lineLength * i, line, lineLength);
+    }
+    strcpy(script + lineLength * iterations, tail);
+
+    double start = now();
+    pid_t spawnpid = fork();
+    switch (spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            // smallsh reads the script on stdin, its output is discarded
+            dup2(input[0], STDIN_FILENO);
+            close(input[0]);
+            close(input[1]);
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            execl(shellPath, shellPath, (char *)NULL);
+            _exit(127);
+            break;
+        default:
+            close(input[0]);
+            writeAll(input[1], script, scriptLength);
+            close(input[1]);
+            waitpid(spawnpid, NULL, 0);
+            break;
+    }
+    double elapsed = now() - start;
+    printf("pipe,%s,%d,%.4f,%.1f,,\n", scenario, iterations, elapsed, iterations / elapsed);
+    fflush(stdout);
+    free(script);
+};
+
+// Reads from the terminal until the prompt is the last thing shown, returns -1 on EOF or timeout
+int waitForPrompt(int master)
+{
+    char buffer[4096];
+    size_t length = 0;
+    while (1)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, 5000) <= 0)
+        {
+            return -1;
+        }
+        ssize_t nread = read(master, buffer + length, sizeof(buffer) - length);
+        if (nread <= 0)
+        {
+            return -1;
+        }
+        length += nread;
+        if (length >= 2 && buffer[length - 2] == ':' && buffer[length - 1] == ' ')
+        {
+            return 0;
+        }
+
+        // Keeps only the tail, the prompt can be split across reads
+        if (length == sizeof(buffer))
+        {
+            buffer[0] = buffer[length - 1];
+            length = 1;
+        }
+    }
+};
+
+// Compares two latencies for qsort
+int compareLatency(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+};
+
+// Runs smallsh interactively on a pseudo-terminal and times each line from the keystroke that
+// submits it until the next prompt is displayed
+void runPty(char *scenario, char *line, int iterations)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+    {
+        perror("posix_openpt()");
+        exit(2);
+    }
+    char *slavePath = ptsname(master);
+
+    pid_t spawnpid = fork();
+    switch (spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            // Starts a session so the terminal becomes smallsh's controlling terminal
+            setsid();
+            close(master);
+            int slave = open(slavePath, O_RDWR);
+            ioctl(slave, TIOCSCTTY, 0);
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+            dup2(slave, STDERR_FILENO);
+            if (slave > STDERR_FILENO)
+            {
+                close(slave);
+            }
+            execl(shellPath, shellPath, (char *)NULL);
+            _exit(127);
+            break;
+        default:
+            break;
+    }
+
+    double *latencies = malloc(iterations * sizeof(double));
+    size_t lineLength = strlen(line);
+    int completed = 0;
+    if (waitForPrompt(master) == 0)
+    {
+        // Sends everything but the newline first, so only the final keystroke is timed
+        double start = now();
+        for (completed = 0; completed < iterations; completed++)
+        {
+            if (lineLength > 1)
+            {
+                writeAll(master, line, lineLength - 1);
+            }
+            double keystroke = now();
+            writeAll(master, "\n", 1);
+            if (waitForPrompt(master) == -1)
+            {
+                break;
+            }
+            latencies[completed] = (now() - keystroke) * 1e6;
+        }
+        double elapsed = now() - start;
+
+        qsort(latencies, completed, sizeof(double), compareLatency);
+        if (completed > 0)
+        {
+            printf("pty,%s,%d,%.4f,%.1f,%.1f,%.1f\n", scenario, completed, elapsed, completed / elapsed,
+                latencies[completed / 2], latencies[completed * 99 / 100]);
+            fflush(stdout);
+        }
+    }
+    if (completed < iterations)
+    {
+        fprintf(stderr, "pty %s: smallsh stopped responding after %d lines\n", scenario, completed);
+    }
+
+    writeAll(master, "exit\n", 5);
+    waitpid(spawnpid, NULL, 0);
+    close(master);
+    free(latencies);
+};
+
+// Output a check has collected from smallsh
+struct output
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Appends bytes to a check's output
+void appendOutput(struct output *out, const char *data, size_t length)
+{
+    if (out->length + length + 1 > out->capacity)
+    {
+        out->capacity = (out->length + length + 1) * 2;
+        out->data = realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+    out->data[out->length] = '\0';
+};
+
+// Replaces what differs between runs with #: PIDs in job messages, and the usage shown when a job is done
+// Carriage returns added by the terminal are dropped
+void normalizeOutput(struct output *out)
+{
+    char *read = out->data;
+    char *write = out->data;
+    while (*read != '\0')
+    {
+        size_t prefix = strncmp(read, "pid is ", 7) == 0 ? 7 : strncmp(read, "background pid ", 15) == 0 ? 15 : 0;
+        if (prefix != 0 && read[prefix] >= '0' && read[prefix] <= '9')
+        {
+            memmove(write, read, prefix);
+            write += prefix;
+            read += prefix;
+            while (*read >= '0' && *read <= '9')
+            {
+                read++;
+            }
+            *write++ = '#';
+            continue;
+        }
+        if (strncmp(read, " (cpu ", 6) == 0)
+        {
+            read = strchr(read, ')') != NULL ? strchr(read, ')') + 1 : read + strlen(read);
+            continue;
+        }
+        if (*read == '\r')
+        {
+            read++;
+            continue;
+        }
+        *write++ = *read++;
+    }
+    *write = '\0';
+    out->length = write - out->data;
+};
+
+// Reports a check, showing both outputs when they differ. Returns 1 if the check failed
+int reportCheck(char *harness, char *name, char *expected, struct output *out, int contains)
+{
+    normalizeOutput(out);
+    int failed = contains != 0 ? strstr(out->data, expected) == NULL : strcmp(out->data, expected) != 0;
+    printf("%s %s,%s\n", failed != 0 ? "FAIL" : "ok", harness, name);
+    if (failed != 0)
+    {
+        printf("--- expected%s\n%s--- got\n%s---\n", contains != 0 ? " (somewhere in the output)" : "", expected, out->data);
+    }
+    fflush(stdout);
+    return failed;
+};
+
+// Runs a script through a pipe, like runPipe, and compares everything smallsh prints with expected
+// Returns 1 if the check failed
+int checkPipe(char *name, char *script, char *expected)
+{
+    int input[2];
+    int output[2];
+    if (pipe(input) == -1 || pipe(output) == -1)
+    {
+        perror("pipe()");
+        exit(2);
+    }
+    pid_t spawnpid = fork();
+    switch (spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            // smallsh reads the script on stdin, stdout and stderr both go to the check
+            dup2(input[0], STDIN_FILENO);
+            dup2(output[1], STDOUT_FILENO);
+            dup2(output[1], STDERR_FILENO);
+            close(input[0]);
+            close(input[1]);
+            close(output[0]);
+            close(output[1]);
+            execl(shellPath, shellPath, (char *)NULL);
+            _exit(127);
+            break;
+        default:
+            break;
+    }
+    close(input[0]);
+    close(output[1]);
+    writeAll(input[1], script, strlen(script));
+    close(input[1]);
+
+    struct output out = {NULL, 0, 0};
+    char buffer[4096];
+    ssize_t nread;
+    appendOutput(&out, "", 0);
+    while ((nread = read(output[0], buffer, sizeof(buffer))) != 0)
+    {
+        if (nread == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (nread == -1)
+        {
+            break;
+        }
+        appendOutput(&out, buffer, nread);
+    }
+    close(output[0]);
+    waitpid(spawnpid, NULL, 0);
+    int failed = reportCheck("pipe", name, expected, &out, 0);
+    free(out.data);
+    return failed;
+};
+
+// Reads from the terminal into out until the prompt is the last thing shown, returns -1 on EOF or timeout
+int collectUntilPrompt(int master, struct output *out)
+{
+    char buffer[4096];
+    while (1)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, 5000) <= 0)
+        {
+            return -1;
+        }
+        ssize_t nread = read(master, buffer, sizeof(buffer));
+        if (nread <= 0)
+        {
+            return -1;
+        }
+        appendOutput(out, buffer, nread);
+        if (out->length >= 2 && out->data[out->length - 2] == ':' && out->data[out->length - 1] == ' ')
+        {
+            return 0;
+        }
+    }
+};
+
+// Types lines into an interactive smallsh, one after each prompt, and checks that expected shows up
+// in what the terminal displayed. Returns 1 if the check failed
+int checkPty(char *name, char **lines, char *expected)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+    {
+        perror("posix_openpt()");
+        exit(2);
+    }
+    char *slavePath = ptsname(master);
+    pid_t spawnpid = fork();
+    switch (spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            // Starts a session so the terminal becomes smallsh's controlling terminal
+            setsid();
+            close(master);
+            int slave = open(slavePath, O_RDWR);
+            ioctl(slave, TIOCSCTTY, 0);
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+            dup2(slave, STDERR_FILENO);
+            if (slave > STDERR_FILENO)
+            {
+                close(slave);
+            }
+            execl(shellPath, shellPath, (char *)NULL);
+            _exit(127);
+            break;
+        default:
+            break;
+    }
+
+    struct output out = {NULL, 0, 0};
+    appendOutput(&out, "", 0);
+    int i;
+    int responding = collectUntilPrompt(master, &out) == 0;
+    for (i = 0; responding != 0 && lines[i] != NULL; i++)
+    {
+        writeAll(master, lines[i], strlen(lines[i]));
+        responding = collectUntilPrompt(master, &out) == 0;
+    }
+    writeAll(master, "exit\n", 5);
+    waitpid(spawnpid, NULL, 0);
+    close(master);
+    int failed = reportCheck("pty", name, expected, &out, 1);
+    if (responding == 0)
+    {
+        printf("FAIL pty,%s: smallsh stopped responding\n", name);
+        failed = 1;
+    }
+    free(out.data);
+    return failed;
+};
+
+// Returns a process's resident set size in kB (VmRSS in /proc/<pid>/status), or -1 if it cannot be read
+long readRss(pid_t pid)
+{
+    char path[64];
+    char line[256];
+    long rss = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *status = fopen(path, "r");
+    if (status == NULL)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+        {
+            rss = atol(line + 6);
+        }
+    }
+    fclose(status);
+    return rss;
+};
+
+// Feeds smallsh batches of lines through a pipe and checks that its VmRSS after the last batch stays
+// within slackKb of what it was after the first one (the per-line arena must not grow with the line count)
+// Returns 1 if the check failed
+int checkRss(char *line, int batches, int linesPerBatch, long slackKb)
+{
+    int input[2];
+    int output[2];
+    if (pipe(input) == -1 || pipe(output) == -1)
+    {
+        perror("pipe()");
+        exit(2);
+    }
+    pid_t spawnpid = fork();
+    switch (spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            dup2(input[0], STDIN_FILENO);
+            dup2(output[1], STDOUT_FILENO);
+            close(input[0]);
+            close(input[1]);
+            close(output[0]);
+            close(output[1]);
+            execl(shellPath, shellPath, (char *)NULL);
+            _exit(127);
+            break;
+        default:
+            break;
+    }
+    close(input[0]);
+    close(output[1]);
+
+    // Each batch ends with a marker line, smallsh has run the whole batch once the marker is read back
+    size_t lineLength = strlen(line);
+    char *batch = malloc(lineLength * linesPerBatch + 32);
+    int i;
+    for (i = 0; i < linesPerBatch; i++)
+    {
+        memcpy(batch + lineLength * i, line, lineLength);
+    }
+    strcpy(batch + lineLength * linesPerBatch, "echo batch\n");
+    size_t batchLength = strlen(batch);
+    long firstRss = -1;
+    long lastRss = -1;
+    int completed;
+    for (completed = 0; completed < batches; completed++)
+    {
+        writeAll(input[1], batch, batchLength);
+        char marker[6];
+        size_t got = 0;
+        while (got < sizeof(marker))
+        {
+            ssize_t nread = read(output[0], marker + got, sizeof(marker) - got);
+            if (nread <= 0)
+            {
+                break;
+            }
+            got += nread;
+        }
+        if (got < sizeof(marker))
+        {
+            break;
+        }
+        lastRss = readRss(spawnpid);
+        if (completed == 0)
+        {
+            firstRss = lastRss;
+        }
+    }
+    close(input[1]);
+    close(output[0]);
+    waitpid(spawnpid, NULL, 0);
+    free(batch);
+
+    int failed = completed < batches || firstRss == -1 || lastRss - firstRss > slackKb;
+    printf("%s rss,%d lines,first %ld kB,last %ld kB\n", failed != 0 ? "FAIL" : "ok", completed * linesPerBatch,
+        firstRss, lastRss);
+    fflush(stdout);
+    return failed;
+};
+
+// Runs every check in a scratch directory, returns the number that failed
+int runChecks()
+{
+    char scratch[] = "/tmp/shell_bench.XXXXXX";
+    if (mkdtemp(scratch) == NULL || chdir(scratch) == -1)
+    {
+        perror("mkdtemp()");
+        exit(2);
+    }
+    int failed = 0;
+
+    // Builtins and exit statuses
+    failed += checkPipe("builtins", "cd /\npwd\nstatus\nfalse\nstatus\n# comment\n\necho a  b\n",
+        "/\nexit value 0\nexit value 1\na b\n");
+    failed += checkPipe("not_found", "nosuchcommand\nstatus\n", "nosuchcommand: No such file or directory\nexit value 1\n");
+    failed += checkPipe("signal_status", "sh -c 'kill -TERM $$'\nstatus\n",
+        "terminated by signal 15\nterminated by signal 15\n");
+
+    // Every combination of arguments, input and output redirection, in the foreground and background
+    failed += checkPipe("no_args", "/bin/echo\n", "\n");
+    failed += checkPipe("args", "/bin/echo one two\n", "one two\n");
+    failed += checkPipe("input", "echo hello > in.txt\n/bin/cat < in.txt\n", "hello\n");
+    failed += checkPipe("args_input", "echo hello > in.txt\n/usr/bin/tr a-z A-Z < in.txt\n", "HELLO\n");
+    failed += checkPipe("output", "/bin/echo > o.txt\n/bin/cat o.txt\n", "\n");
+    failed += checkPipe("args_output", "/bin/echo out > o.txt\n/bin/cat o.txt\n", "out\n");
+    failed += checkPipe("input_output", "echo hello > in.txt\n/bin/cat < in.txt > io.txt\n/bin/cat io.txt\n", "hello\n");
+    failed += checkPipe("args_input_output", "echo hello > in.txt\n/usr/bin/tr a-z A-Z < in.txt > up.txt\n/bin/cat up.txt\n",
+        "HELLO\n");
+    failed += checkPipe("bad_input", "/bin/cat < missing.txt\nstatus\n", "cannot open missing.txt for input\nexit value 1\n");
+    failed += checkPipe("bad_output", "/bin/echo x > /nonexistent/o.txt\nstatus\n",
+        "cannot open /nonexistent/o.txt for output\nexit value 1\n");
+    failed += checkPipe("background_output", "/bin/echo bg > bg.txt &\nwait\n/bin/cat bg.txt\n",
+        "background pid is #\nbackground pid # is done: exit value 0\nbg\n");
+    failed += checkPipe("background_input", "echo hello > in.txt\n/bin/cat < in.txt &\nwait\n",
+        "background pid is #\nbackground pid # is done: exit value 0\n");
+    failed += checkPipe("background_input_output", "echo hello > in.txt\n/bin/cat < in.txt > bg.txt &\nwait\n/bin/cat bg.txt\n",
+        "background pid is #\nbackground pid # is done: exit value 0\nhello\n");
+    failed += checkPipe("background_args_input_output",
+        "echo hello > in.txt\n/usr/bin/tr a-z A-Z < in.txt > bg.txt &\nwait\n/bin/cat bg.txt\n",
+        "background pid is #\nbackground pid # is done: exit value 0\nHELLO\n");
+    failed += checkPipe("background_killed", "sleep 5 &\nkill %1\nwait\n",
+        "background pid is #\nbackground pid # is done: terminated by signal 15\n");
+    failed += checkPipe("background_status", "sh -c 'sleep 0.3; exit 3' &\nwait %1\necho $?\nstatus\n",
+        "background pid is #\nbackground pid # is done: exit value 3\n3\nexit value 0\n");
+
+    // The same through an interactive terminal, with job control
+    char *builtinLines[] = {"cd /\n", "pwd\n", "status\n", NULL};
+    failed += checkPty("builtins", builtinLines, "pwd\n/\n: status\nexit value 0\n");
+    char *redirectionLines[] = {"/bin/echo hi > o.txt\n", "/bin/cat < o.txt\n", NULL};
+    failed += checkPty("redirection", redirectionLines, "/bin/cat < o.txt\nhi\n");
+    char *backgroundLines[] = {"/bin/echo bg > bg.txt &\n", "wait\n", "/bin/cat bg.txt\n", NULL};
+    failed += checkPty("background", backgroundLines, "background pid # is done: exit value 0\n");
+    char *statusLines[] = {"false\n", "status\n", NULL};
+    failed += checkPty("status", statusLines, "exit value 1\n");
+
+    // Memory stays flat however many lines are parsed, expanded and run
+    failed += checkRss("X=value; [ -n \"$X\" ] && echo \"${X} $$\" > /dev/null; cd . # comment\n", 20, 10000, 512);
+
+    char cleanup[64];
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s", scratch);
+    system(cleanup);
+    return failed;
+};
+
+int main(int argc, char *argv[])
+{
+    int iterations = 2000;
+    if (argc > 1 && strcmp(argv[1], "--check") == 0)
+    {
+        // Checks run from a scratch directory, so the binary's path is made absolute first
+        static char absolutePath[PATH_MAX];
+        if (realpath(argc > 2 ? argv[2] : shellPath, absolutePath) == NULL || access(absolutePath, X_OK) == -1)
+        {
+            perror(argc > 2 ? argv[2] : shellPath);
+            return 1;
+        }
+        shellPath = absolutePath;
+        int failed = runChecks();
+        printf("%d checks failed\n", failed);
+        return failed != 0;
+    }
+    if (argc > 1)
+    {
+        shellPath = argv[1];
+    }
+    if (argc > 2)
+    {
+        iterations = atoi(argv[2]);
+    }
+    if (access(shellPath, X_OK) == -1)
+    {
+        perror(shellPath);
+        return 1;
+    }
+
+    printf("harness,scenario,iterations,seconds,ops_per_sec,p50_us,p99_us\n");
+    runPipe("builtin", "cd .\n", "", iterations * 10);
+    runPipe("echo", "echo hello world\n", "", iterations * 10);
+    runPipe("test", "[ -d / ] && true\n", "", iterations * 10);
+    runPipe("true", "/bin/true\n", "", iterations);
+    runPipe("redirection", "/bin/true < /dev/null > /dev/null 2>&1 3>> /dev/null\n", "", iterations);
+    runPipe("heredoc", "/bin/true <<EOF\nkey=value\nEOF\n", "", iterations);
+    runPipe("pipeline", "/bin/true | /bin/true | /bin/true\n", "", iterations / 3);
+    runPipe("background_burst", "/bin/true &\n", "wait\n", iterations);
+    runPty("empty_line", "\n", iterations);
+    runPty("builtin", "cd .\n", iterations);
+    runPty("true", "/bin/true\n", iterations / 2);
+    return 0;
+};
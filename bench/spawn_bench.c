@@ -0,0 +1,115 @@
+/*
+spawn_bench
+Measures launch throughput (commands/sec) of fork()+execv() versus posix_spawn()
+while the parent holds a resident ballast of increasing size.
+
+Build: gcc --std=c99 -O2 -o spawn_bench spawn_bench.c
+Usage: ./spawn_bench [iterations] [ballast MB ...]
+Output: CSV lines of method,ballast_mb,iterations,seconds,commands_per_sec
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <spawn.h>
+
+// Returns current monotonic time in seconds
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+// Launches /bin/true with fork()+execv(), the way smallsh originally did
+void launchFork()
+{
+    char *argv[] = {"/bin/true", NULL};
+    int status;
+    pid_t spawnpid = fork();
+    switch(spawnpid)
+    {
+        case -1:
+            perror("fork()");
+            exit(2);
+            break;
+        case 0:
+            execv(argv[0], argv);
+            _exit(127);
+            break;
+        default:
+            waitpid(spawnpid, &status, 0);
+            break;
+    }
+};
+
+// Launches /bin/true with posix_spawn(), the way smallsh launches commands now
+void launchSpawn()
+{
+    char *argv[] = {"/bin/true", NULL};
+    int status;
+    pid_t spawnpid;
+    if (posix_spawn(&spawnpid, argv[0], NULL, NULL, argv, environ) != 0)
+    {
+        perror("posix_spawn()");
+        exit(2);
+    }
+    waitpid(spawnpid, &status, 0);
+};
+
+// Times a launch method and prints one CSV line
+void run(char *method, void (*launch)(), long ballastMb, int iterations)
+{
+    int i;
+    double start = now();
+    for (i = 0; i < iterations; i++)
+    {
+        launch();
+    }
+    double elapsed = now() - start;
+    printf("%s,%ld,%d,%.4f,%.1f\n", method, ballastMb, iterations, elapsed, iterations / elapsed);
+    fflush(stdout);
+};
+
+int main(int argc, char *argv[])
+{
+    int iterations = 500;
+    long defaultSizes[] = {0, 64, 256, 1024};
+    int i;
+
+    if (argc > 1)
+    {
+        iterations = atoi(argv[1]);
+    }
+
+    printf("method,ballast_mb,iterations,seconds,commands_per_sec\n");
+    int sizeCount = argc > 2 ? argc - 2 : 4;
+    for (i = 0; i < sizeCount; i++)
+    {
+        long ballastMb = argc > 2 ? atol(argv[i + 2]) : defaultSizes[i];
+
+        // Touches every page of the ballast so it is resident and mapped in the page tables
+        size_t ballastSize = (size_t)ballastMb * 1024 * 1024;
+        char *ballast = NULL;
+        if (ballastSize > 0)
+        {
+            ballast = malloc(ballastSize);
+            if (ballast == NULL)
+            {
+                perror("malloc()");
+                return 1;
+            }
+            memset(ballast, 1, ballastSize);
+        }
+
+        run("fork_execv", launchFork, ballastMb, iterations);
+        run("posix_spawn", launchSpawn, ballastMb, iterations);
+        free(ballast);
+    }
+    return 0;
+};
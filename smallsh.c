@@ -18,203 +18,5826 @@ Alex Li
 #include <errno.h>
 #include <ctype.h>
 #include <signal.h>
+#include <spawn.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdarg.h>
+
+#define PATH_CACHE_SIZE 256  // Number of buckets in the executable lookup cache
+#define DEFAULT_PATH "/bin:/usr/bin"  // Search path used when PATH is unset
+#define INPUT_CHUNK_SIZE 65536  // Bytes requested per read() when input is not a mapped file
+#define MAPPED_RELEASE_SIZE 1048576  // Consumed bytes of a mapped script dropped from memory at a time
+#define ARENA_BLOCK_SIZE 16384  // Initial size of the per-line arena
+#define ARENA_ALIGNMENT 16  // Alignment of every arena allocation
+#define HISTOGRAM_SUB_BUCKETS 16  // Buckets per power of two in latency histograms (6.25% precision)
+#define HISTOGRAM_BUCKETS (61 * HISTOGRAM_SUB_BUCKETS)  // Enough buckets for any 64-bit microsecond count
+#define STATS_TABLE_SIZE 64  // Number of buckets in the table of per-command latency histograms
+#define TRACE_BUFFER_SIZE 1048576  // Bytes of trace events collected before they are written out
+#define COMMAND_INLINE_ARGV 16  // argv slots kept inside a command before it spills to the arena
+#define CACHE_DIRECTORY_NAME ".smallsh_cache"  // Output cache of the cached builtin in HOME, unless SMALLSH_CACHE_DIR names another
+#define CACHE_HEADER_SIZE 29  // Length of the first line of a cache entry: "smallsh cache <status> <key length>"
+#define CACHE_READ_SIZE 65536  // Bytes copied per read when a cache entry is replayed
+#define HISTORY_FILE_NAME ".smallsh_history"  // History file in HOME, unless SMALLSH_HISTFILE names another
+#define HISTORY_GRAM_BUCKETS 65536  // Buckets of the trigram index of the history used by !?string? (a power of two)
+#define JOBLOG_BUFFER_SIZE 65536  // Bytes of captured output kept per background job (older output is dropped)
+#define SUBSTITUTION_READ_SIZE 65536  // Bytes of command substitution output read at a time
+#define BUILTIN_TABLE_SIZE 16  // Slots in the perfect hash table of in-process builtins (a power of two)
+#define SHELL_FD_BASE 10  // Lowest descriptor the shell keeps for itself, redirections only reach the ones below
 
 // Global variables
 int foregroundMode = 0;  // Tracks mode program is running in
 int foregroundHelper = 0;  // Determines if a foreground child process is currently running (used to handle SIGTSTP)
 int childStatus;  // Status of current foreground child process
+volatile sig_atomic_t modeMessagePending = 0;  // Set when SIGTSTP arrives while a foreground process is running
+int pipefailMode = 0;  // Whether a pipeline's status is that of its last failing stage rather than its last stage
+int statsMode = 0;  // Whether job latencies are recorded for the stats builtin
+int joblogMode = 0;  // Whether background jobs' output is captured for the joblog builtin (set -o joblog)
+int timestampMode = 0;  // Whether captured lines start with the time they were read (set -o timestamps)
+int interactiveMode = 0;  // Whether input comes from a terminal (prompts are only printed then)
+pid_t *parallelPids = NULL;  // PIDs running in each slot of the parallel builtin (0 for free slots)
+int parallelLimit = 0;  // Number of slots in parallelPids (0 when parallel is not running)
+volatile sig_atomic_t parallelInterrupted = 0;  // Set by SIGINT to stop parallel from starting more commands
+volatile sig_atomic_t childExited = 0;  // Set by the SIGCHLD handler until background processes are reaped
+int reapPipe[2] = {-1, -1};  // Self-pipe written by the SIGCHLD handler to wake up a wait for input
+int jobControl = 0;  // Whether jobs get their own process groups handed the terminal (interactive only)
+pid_t shellPgid;  // Process group of smallsh itself
+struct termios shellModes;  // Terminal modes restored whenever smallsh takes the terminal back
+char shellPidString[16];  // Value of $$, formatted once at startup
+pid_t lastBackgroundPid = 0;  // Value of $! (0 until a background job is started)
+int substitutionsEnabled = 1;  // Whether command substitutions run (parse_bench turns them off to time parsing alone)
+int substitutionInterrupted = 0;  // Set when a command substitution is killed by SIGINT, the line is abandoned
+int cgroupSequence = 0;  // Number of the last job cgroup created, part of the cgroup names
+char *spawnCgroup = NULL;  // cgroup v2 leaf the stages being spawned join before exec (NULL if none)
+
+// Block of memory handed out by an arena
+struct arenaBlock
+{
+    struct arenaBlock *next;  // Previously filled block
+    size_t capacity;
+    size_t used;
+    char data[];
+};
+
+// Bump allocator for per-line parse state, everything in it is released at once by arenaReset
+struct arena
+{
+    struct arenaBlock *head;  // Block allocations are currently taken from
+    size_t total;  // Bytes handed out since the last reset (sizes the block kept by the next reset)
+};
+
+struct arena lineArena = {NULL, 0};  // Holds the parsed command and its strings for the current line
+
+// Adds a block of at least size bytes to the front of an arena
+void arenaGrow(struct arena *currArena, size_t size)
+{
+    size_t capacity = ARENA_BLOCK_SIZE;
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    struct arenaBlock *block = malloc(sizeof(struct arenaBlock) + capacity);
+    if (block == NULL)
+    {
+        perror("malloc()");
+        exit(2);
+    }
+    block->next = currArena->head;
+    block->capacity = capacity;
+    block->used = 0;
+    currArena->head = block;
+};
+
+// Returns size bytes of aligned memory from an arena
+void *arenaAlloc(struct arena *currArena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (currArena->head == NULL || currArena->head->capacity - currArena->head->used < size)
+    {
+        arenaGrow(currArena, size);
+    }
+    void *allocation = currArena->head->data + currArena->head->used;
+    currArena->head->used += size;
+    currArena->total += size;
+    return allocation;
+};
+
+// Copies length bytes of str into an arena as a NUL-terminated string
+char *arenaStrndup(struct arena *currArena, const char *str, size_t length)
+{
+    char *copy = arenaAlloc(currArena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+};
+
+// Releases everything allocated from an arena
+// If the last line needed more than one block, they are replaced by a single block that fits it all
+void arenaReset(struct arena *currArena)
+{
+    if (currArena->head != NULL && currArena->head->next != NULL)
+    {
+        while (currArena->head != NULL)
+        {
+            struct arenaBlock *block = currArena->head;
+            currArena->head = block->next;
+            free(block);
+        }
+        arenaGrow(currArena, currArena->total);
+    }
+    if (currArena->head != NULL)
+    {
+        currArena->head->used = 0;
+    }
+    currArena->total = 0;
+};
+
+// Moves a descriptor the shell opens to SHELL_FD_BASE or above (close-on-exec), out of the range
+// commands redirect, so n>&m can never reach it. Returns the new descriptor
+int moveDescriptor(int fd)
+{
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+    if (moved == -1)
+    {
+        return fd;
+    }
+    close(fd);
+    return moved;
+};
+
+// Shell variable, exported ones are passed to commands in their environment
+struct variable
+{
+    char *name;  // NULL for an empty slot
+    char *value;  // NULL if the variable was exported before it was given a value
+    unsigned int hash;
+    int exported;
+};
+
+struct variable *variableTable = NULL;  // Open-addressing hash table of variables, probed linearly
+size_t variableCapacity = 0;  // Number of slots in variableTable (a power of two)
+size_t variableCount = 0;
+char **exportedEnvironment = NULL;  // Environment passed to commands, in one allocation
+int environmentChanged = 1;  // Whether exportedEnvironment must be rebuilt before the next command
+
+// Returns the FNV-1a hash of the first length bytes of a string
+unsigned int hashString(const char *str, size_t length)
+{
+    unsigned int hash = 2166136261u;
+    const char *end = str + length;
+    while (str < end)
+    {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+};
+
+// Returns the length of the variable name at the start of a string (0 if it does not start with one)
+size_t nameLength(const char *str)
+{
+    size_t length = 0;
+    if (isalpha((unsigned char)str[0]) || str[0] == '_')
+    {
+        while (isalnum((unsigned char)str[length]) || str[length] == '_')
+        {
+            length++;
+        }
+    }
+    return length;
+};
+
+// Returns the slot holding the variable named by the first length bytes of name,
+// or the empty slot where it would be inserted
+struct variable *findVariable(const char *name, size_t length, unsigned int hash)
+{
+    size_t mask = variableCapacity - 1;
+    size_t i = hash & mask;
+    while (variableTable[i].name != NULL)
+    {
+        if (variableTable[i].hash == hash && strncmp(variableTable[i].name, name, length) == 0 &&
+        variableTable[i].name[length] == '\0')
+        {
+            return &variableTable[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return &variableTable[i];
+};
+
+// Doubles the variable table and reinserts every variable
+void growVariableTable()
+{
+    struct variable *oldTable = variableTable;
+    size_t oldCapacity = variableCapacity;
+    size_t i;
+    variableCapacity = oldCapacity == 0 ? 64 : oldCapacity * 2;
+    variableTable = calloc(variableCapacity, sizeof(struct variable));
+    for (i = 0; i < oldCapacity; i++)
+    {
+        if (oldTable[i].name != NULL)
+        {
+            *findVariable(oldTable[i].name, strlen(oldTable[i].name), oldTable[i].hash) = oldTable[i];
+        }
+    }
+    free(oldTable);
+};
+
+// Returns the value of the variable named by the first length bytes of name (NULL if it is unset)
+char *lookupVariable(const char *name, size_t length)
+{
+    if (variableCount == 0)
+    {
+        return NULL;
+    }
+    return findVariable(name, length, hashString(name, length))->value;
+};
+
+// Returns the value of a variable (NULL if it is unset)
+char *getVariable(const char *name)
+{
+    return lookupVariable(name, strlen(name));
+};
+
+// Sets the variable named by the first length bytes of name
+// A NULL value keeps the current value, exported marks the variable for export (it is never unmarked)
+void setVariable(const char *name, size_t length, const char *value, int exported)
+{
+    // Keeps the table at most half full so probe sequences stay short
+    if ((variableCount + 1) * 2 > variableCapacity)
+    {
+        growVariableTable();
+    }
+    unsigned int hash = hashString(name, length);
+    struct variable *var = findVariable(name, length, hash);
+    if (var->name == NULL)
+    {
+        var->name = strndup(name, length);
+        var->value = NULL;
+        var->hash = hash;
+        var->exported = 0;
+        variableCount += 1;
+    }
+    if (value != NULL)
+    {
+        free(var->value);
+        var->value = strdup(value);
+    }
+    if (exported != 0)
+    {
+        var->exported = 1;
+    }
+    if (var->exported != 0)
+    {
+        environmentChanged = 1;
+    }
+};
+
+// Removes a variable, shifting later entries of its probe sequence back so no tombstones are needed
+void unsetVariable(const char *name)
+{
+    if (variableCount == 0)
+    {
+        return;
+    }
+    size_t length = strlen(name);
+    struct variable *var = findVariable(name, length, hashString(name, length));
+    if (var->name == NULL)
+    {
+        return;
+    }
+    if (var->exported != 0)
+    {
+        environmentChanged = 1;
+    }
+    free(var->name);
+    free(var->value);
+    variableCount -= 1;
+
+    // An entry may fill the hole unless its home slot lies between the hole and the entry
+    size_t mask = variableCapacity - 1;
+    size_t hole = var - variableTable;
+    size_t i = hole;
+    while (variableTable[i = (i + 1) & mask].name != NULL)
+    {
+        size_t home = variableTable[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            variableTable[hole] = variableTable[i];
+            hole = i;
+        }
+    }
+    variableTable[hole].name = NULL;
+    variableTable[hole].value = NULL;
+};
+
+// Returns the environment for commands, rebuilt only when an exported variable changed since the last call
+char **commandEnvironment()
+{
+    if (environmentChanged == 0)
+    {
+        return exportedEnvironment;
+    }
+
+    // Sizes the pointer array and the NAME=value strings so they fit in one allocation
+    size_t count = 0;
+    size_t size = 0;
+    size_t i;
+    for (i = 0; i < variableCapacity; i++)
+    {
+        if (variableTable[i].name != NULL && variableTable[i].exported != 0 && variableTable[i].value != NULL)
+        {
+            count += 1;
+            size += strlen(variableTable[i].name) + strlen(variableTable[i].value) + 2;
+        }
+    }
+    free(exportedEnvironment);
+    exportedEnvironment = malloc((count + 1) * sizeof(char *) + size);
+    char *text = (char *)(exportedEnvironment + count + 1);
+    count = 0;
+    for (i = 0; i < variableCapacity; i++)
+    {
+        if (variableTable[i].name != NULL && variableTable[i].exported != 0 && variableTable[i].value != NULL)
+        {
+            exportedEnvironment[count++] = text;
+            text += sprintf(text, "%s=%s", variableTable[i].name, variableTable[i].value) + 1;
+        }
+    }
+    exportedEnvironment[count] = NULL;
+    environmentChanged = 0;
+    return exportedEnvironment;
+};
+
+// Imports the environment smallsh was started with as exported variables
+void importEnvironment()
+{
+    char **env;
+    for (env = environ; *env != NULL; env++)
+    {
+        char *separator = strchr(*env, '=');
+        if (separator != NULL)
+        {
+            setVariable(*env, separator - *env, separator + 1, 1);
+        }
+    }
+};
+
+// Kinds of redirection
+enum redirectionType
+{
+    REDIRECT_INPUT,  // n<file
+    REDIRECT_OUTPUT,  // n>file
+    REDIRECT_APPEND,  // n>>file
+    REDIRECT_READWRITE,  // n<>file
+    REDIRECT_DUPLICATE,  // n>&m or n<&m
+    REDIRECT_CLOSE,  // n>&- or n<&-
+    REDIRECT_DOCUMENT  // n<<delimiter or n<<<word, the text is read from the descriptor
+};
+
+// Redirection of one descriptor of a command, applied in the child in the order they were written
+struct redirection
+{
+    enum redirectionType type;
+    int fd;  // Descriptor of the command that is redirected
+    char *fileName;  // File to open, or the text of a here-document (NULL for duplicates and closes)
+    int sourceFd;  // Descriptor duplicated onto fd, for files the one opened by the parent
+    struct redirection *next;
+};
+
+// Resource limits applied to every process of a job (0 for limits that are not set)
+struct jobLimits
+{
+    rlim_t addressSpace;  // RLIMIT_AS in bytes (limit -m)
+    rlim_t cpuSeconds;  // RLIMIT_CPU in seconds (limit -t)
+    rlim_t openFiles;  // RLIMIT_NOFILE (limit -n)
+    long long memoryMax;  // memory.max of the job's cgroup in bytes (limit -M)
+    int cpuPercent;  // cpu.max of the job's cgroup, in percent of one CPU (limit -c)
+};
+
+struct jobLimits defaultLimits = {0};  // Limits set by limit without a command, applied to every job
+
+// Structure for storing elements of a command
+struct command 
+{
+    char *name;
+    char **argv;  // exec() argument vector: name, arguments, then NULL
+    char **arguments;  // Points just past the name in argv
+    struct redirection *redirections;  // Redirections in the order they were written
+    struct redirection **redirectionLink;  // Where the next redirection is linked in
+    int mode;  // Whether command will run in foreground/background
+    int timed;  // Whether the pipeline was prefixed with time (set on its first stage)
+    struct jobLimits *limits;  // Limits given to the pipeline by the limit prefix (NULL for defaultLimits)
+    int argCount;
+    int argCapacity;  // Slots in argv, including the name and the terminating NULL
+    char **assignments;  // NAME=value words written before the name (NULL if there are none)
+    int assignmentCount;
+    int assignmentCapacity;
+    struct command *next;  // Next stage of the pipeline (NULL for the last stage)
+    char *inlineArgv[COMMAND_INLINE_ARGV];  // Storage for argv until a command outgrows it
+};
+
+// Kinds of tokens produced by the lexer
+enum tokenType
+{
+    TOKEN_END,  // End of the line
+    TOKEN_WORD,  // Command name, argument or file name (may contain quotes and escapes)
+    TOKEN_INPUT,  // <
+    TOKEN_OUTPUT,  // >
+    TOKEN_APPEND,  // >>
+    TOKEN_READWRITE,  // <>
+    TOKEN_HEREDOC,  // <<
+    TOKEN_HEREDOC_STRIP,  // <<-
+    TOKEN_HERESTRING,  // <<<
+    TOKEN_DUPLICATE_INPUT,  // <&
+    TOKEN_DUPLICATE_OUTPUT,  // >&
+    TOKEN_OUTPUT_ALL,  // &>
+    TOKEN_APPEND_ALL,  // &>>
+    TOKEN_PIPE,  // |
+    TOKEN_OR,  // ||
+    TOKEN_BACKGROUND,  // &
+    TOKEN_AND,  // &&
+    TOKEN_SEMICOLON,  // ;
+    TOKEN_ERROR  // Unterminated quote or command substitution, or trailing backslash
+};
+
+// Token of an input line, stored as a slice of the line rather than a copy
+struct token
+{
+    enum tokenType type;
+    size_t start;  // Offset of the token in the line
+    size_t length;
+    int fd;  // Descriptor number written before a redirection operator (2> gives 2), -1 if none
+    int quoted;  // Whether a word contains quotes or backslashes that must be removed
+    int expand;  // Whether a word contains a $ outside single quotes
+};
+
+// Element of a command list: a pipeline and the operator written after it
+struct commandList
+{
+    size_t start;  // Offset of the pipeline in the line
+    struct command *pipeline;  // Parsed pipeline, NULL until it is parsed just before it runs
+    enum tokenType connector;  // TOKEN_END, TOKEN_SEMICOLON, TOKEN_BACKGROUND, TOKEN_AND or TOKEN_OR
+    char *text;  // Command text of the pipeline shown in job listings
+    struct commandList *next;
+};
+
+// Returns the end of the command substitution $(...) or `...` starting at p, just past its closing
+// ) or `, or NULL if the line ends first. Parentheses nest, quotes and escapes inside are skipped whole
+const char *skipSubstitution(const char *p)
+{
+    int depth = 0;
+    if (*p == '`')
+    {
+        for (p++; *p != '`'; p += (*p == '\\' && p[1] != '\0') ? 2 : 1)
+        {
+            if (*p == '\0' || *p == '\n')
+            {
+                return NULL;
+            }
+        }
+        return p + 1;
+    }
+    for (p++; *p != '\0' && *p != '\n'; p++)
+    {
+        if (*p == '(')
+        {
+            depth++;
+        }
+        else if (*p == ')' && --depth == 0)
+        {
+            return p + 1;
+        }
+        else if (*p == '\\' && p[1] != '\0')
+        {
+            p++;
+        }
+        else if (*p == '`')
+        {
+            p = skipSubstitution(p);
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            p--;
+        }
+        else if (*p == '\'' || *p == '"')
+        {
+            // Quoted text inside the substitution, double quotes can hold substitutions of their own
+            char quote = *p;
+            for (p++; *p != quote; p++)
+            {
+                if (*p == '\0' || *p == '\n')
+                {
+                    return NULL;
+                }
+                if (quote == '"' && *p == '\\' && p[1] != '\0')
+                {
+                    p++;
+                }
+                else if (quote == '"' && ((*p == '$' && p[1] == '(') || *p == '`'))
+                {
+                    p = skipSubstitution(p);
+                    if (p == NULL)
+                    {
+                        return NULL;
+                    }
+                    p--;
+                }
+            }
+        }
+    }
+    return NULL;
+};
+
+// Body of a here-document, read from the lines after the command line that uses it
+struct hereDocument
+{
+    const char *delimiter;  // Delimiter word in the command line, identifies the redirection
+    char *body;  // Lines before the delimiter line, each with its newline
+    int expand;  // Whether the delimiter was unquoted, so the body gets parameters and substitutions expanded
+    struct hereDocument *next;
+};
+
+struct hereDocument *hereDocuments = NULL;  // Here-documents of the current line (in the line arena)
+
+// Scans the token starting at *pos and advances *pos past it, in one pass with no copies
+// Blanks are spaces and tabs, the line ends at a newline or NUL
+enum tokenType nextToken(const char *line, size_t *pos, struct token *tok)
+{
+    size_t i = *pos;
+    while (line[i] == ' ' || line[i] == '\t')
+    {
+        i++;
+    }
+    tok->start = i;
+    tok->fd = -1;
+    tok->quoted = 0;
+    tok->expand = 0;
+
+    // Digits written directly before < or > select the descriptor to redirect (2>, 0<, 2>>)
+    size_t j = i;
+    while (line[j] >= '0' && line[j] <= '9')
+    {
+        j++;
+    }
+    if (j > i && (line[j] == '<' || line[j] == '>'))
+    {
+        tok->fd = atoi(line + i);
+        i = j;
+    }
+
+    // Operators
+    switch (line[i])
+    {
+        case '\0':
+        case '\n':
+            tok->type = TOKEN_END;
+            break;
+        case '<':
+            if (line[i + 1] == '<')
+            {
+                tok->type = line[i + 2] == '<' ? TOKEN_HERESTRING : line[i + 2] == '-' ? TOKEN_HEREDOC_STRIP : TOKEN_HEREDOC;
+                i += tok->type == TOKEN_HEREDOC ? 2 : 3;
+                break;
+            }
+            tok->type = line[i + 1] == '>' ? TOKEN_READWRITE : line[i + 1] == '&' ? TOKEN_DUPLICATE_INPUT : TOKEN_INPUT;
+            i += tok->type == TOKEN_INPUT ? 1 : 2;
+            break;
+        case '>':
+            tok->type = line[i + 1] == '>' ? TOKEN_APPEND : line[i + 1] == '&' ? TOKEN_DUPLICATE_OUTPUT : TOKEN_OUTPUT;
+            i += tok->type == TOKEN_OUTPUT ? 1 : 2;
+            break;
+        case '|':
+            tok->type = line[i + 1] == '|' ? TOKEN_OR : TOKEN_PIPE;
+            i += tok->type == TOKEN_OR ? 2 : 1;
+            break;
+        case '&':
+            if (line[i + 1] == '>')
+            {
+                tok->type = line[i + 2] == '>' ? TOKEN_APPEND_ALL : TOKEN_OUTPUT_ALL;
+                i += tok->type == TOKEN_APPEND_ALL ? 3 : 2;
+                break;
+            }
+            tok->type = line[i + 1] == '&' ? TOKEN_AND : TOKEN_BACKGROUND;
+            i += tok->type == TOKEN_AND ? 2 : 1;
+            break;
+        case ';':
+            tok->type = TOKEN_SEMICOLON;
+            i += 1;
+            break;
+        default:
+            tok->type = TOKEN_WORD;
+            break;
+    }
+
+    // Word: runs to the next blank or operator, quoted sections and escaped characters included
+    while (tok->type == TOKEN_WORD)
+    {
+        char c = line[i];
+        if (c == '\\')
+        {
+            tok->quoted = 1;
+            if (line[i + 1] == '\0' || line[i + 1] == '\n')
+            {
+                tok->type = TOKEN_ERROR;
+                break;
+            }
+            i += 2;
+        }
+        else if (c == '\'' || c == '"')
+        {
+            // Finds the closing quote, inside double quotes a backslash escapes the next character
+            tok->quoted = 1;
+            i += 1;
+            while (line[i] != c && line[i] != '\0')
+            {
+                if (c == '"' && (line[i] == '$' || line[i] == '`'))
+                {
+                    tok->expand = 1;
+                }
+                if (c == '"' && ((line[i] == '$' && line[i + 1] == '(') || line[i] == '`'))
+                {
+                    const char *close = skipSubstitution(line + i);
+                    i = close != NULL ? (size_t)(close - line) : strlen(line);
+                    continue;
+                }
+                i += (c == '"' && line[i] == '\\' && line[i + 1] != '\0') ? 2 : 1;
+            }
+            if (line[i] == '\0')
+            {
+                tok->type = TOKEN_ERROR;
+                break;
+            }
+            i += 1;
+        }
+        else if (c == '\0' || c == '\n' || c == ' ' || c == '\t' || c == '<' || c == '>' ||
+        c == '|' || c == '&' || c == ';')
+        {
+            break;
+        }
+        else if ((c == '$' && line[i + 1] == '(') || c == '`')
+        {
+            // Command substitution, kept whole however many blanks or operators it contains
+            const char *close = skipSubstitution(line + i);
+            tok->expand = 1;
+            if (close == NULL)
+            {
+                tok->type = TOKEN_ERROR;
+                break;
+            }
+            i = close - line;
+        }
+        else
+        {
+            if (c == '$')
+            {
+                tok->expand = 1;
+            }
+            i += 1;
+        }
+    }
+    tok->length = i - tok->start;
+    *pos = i;
+    return tok->type;
+};
+
+// Word being built in the line arena, always with room left for the rest of its token
+struct wordBuffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Appends the value of an expansion, moving the word to a larger block if the value and
+// the reserve bytes still to be copied from the token would not fit
+void appendExpansion(struct wordBuffer *word, const char *value, size_t length, size_t reserve)
+{
+    if (word->length + length + reserve > word->capacity)
+    {
+        word->capacity = (word->length + length + reserve) * 2;
+        char *data = arenaAlloc(&lineArena, word->capacity);
+        memcpy(data, word->data, word->length);
+        word->data = data;
+    }
+    memcpy(word->data + word->length, value, length);
+    word->length += length;
+};
+
+// Runs a command substitution's text and appends its output to word (defined with the execution stage)
+void commandSubstitution(char *text, struct wordBuffer *word);
+
+const char *substitutionText = NULL;  // Text of the command substitution being run (NULL outside one)
+const char *substitutionOrigin = NULL;  // Where that text starts in the command line
+
+// Returns where p, in the command line or the text of the running command substitution, is in the
+// command line. Here-documents are found by their delimiter's place there, also inside substitutions
+const char *linePosition(const char *p)
+{
+    if (substitutionText != NULL && p >= substitutionText && p <= substitutionText + strlen(substitutionText))
+    {
+        return substitutionOrigin + (p - substitutionText);
+    }
+    return p;
+};
+
+// Expands the command substitution at p ($(...) or `...`) into word, returns the position after it
+const char *expandSubstitution(const char *p, const char *end, struct wordBuffer *word)
+{
+    const char *close = skipSubstitution(p);
+    char *text;
+    if (*p == '`')
+    {
+        // Inside backquotes a backslash only escapes `, \ and $
+        size_t length = 0;
+        const char *q;
+        text = arenaAlloc(&lineArena, close - p);
+        for (q = p + 1; q < close - 1; q++)
+        {
+            if (*q == '\\' && (q[1] == '`' || q[1] == '\\' || q[1] == '$'))
+            {
+                q++;
+            }
+            text[length++] = *q;
+        }
+        text[length] = '\0';
+    }
+    else
+    {
+        text = arenaStrndup(&lineArena, p + 2, close - p - 3);
+    }
+    const char *savedText = substitutionText;
+    const char *savedOrigin = substitutionOrigin;
+    substitutionOrigin = linePosition(p + (*p == '`' ? 1 : 2));
+    substitutionText = text;
+    commandSubstitution(text, word);
+    substitutionText = savedText;
+    substitutionOrigin = savedOrigin;
+
+    // Leaves room for the literal text after the substitution, like every other expansion
+    appendExpansion(word, "", 0, end - close + 1);
+    return close;
+};
+
+// Expands the parameter starting with the $ at p ($NAME, ${NAME}, $?, $!, $$ or $(command)) into word
+// and returns the position after it, a $ that does not start a parameter is kept as is
+const char *expandParameter(const char *p, const char *end, struct wordBuffer *word)
+{
+    char number[16];
+    const char *value = "";
+    const char *next = p + 1;
+    if (next < end && *next == '(')
+    {
+        return expandSubstitution(p, end, word);
+    }
+
+    // Special parameters
+    if (next < end && (*next == '?' || *next == '!' || *next == '$'))
+    {
+        if (*next == '$')
+        {
+            value = shellPidString;
+        }
+        else if (*next == '?')
+        {
+            sprintf(number, "%d", WIFEXITED(childStatus) ? WEXITSTATUS(childStatus) : 128 + WTERMSIG(childStatus));
+            value = number;
+        }
+        else if (lastBackgroundPid != 0)
+        {
+            sprintf(number, "%d", (int)lastBackgroundPid);
+            value = number;
+        }
+        next += 1;
+    }
+    // Named variables, with or without braces
+    else
+    {
+        int braced = next < end && *next == '{';
+        const char *name = braced ? next + 1 : next;
+        const char *nameEnd = name;
+        if (nameEnd < end && (isalpha((unsigned char)*nameEnd) || *nameEnd == '_'))
+        {
+            while (nameEnd < end && (isalnum((unsigned char)*nameEnd) || *nameEnd == '_'))
+            {
+                nameEnd++;
+            }
+        }
+        if (nameEnd == name || (braced && (nameEnd == end || *nameEnd != '}')))
+        {
+            word->data[word->length++] = '$';
+            return p + 1;
+        }
+        value = lookupVariable(name, nameEnd - name);
+        if (value == NULL)
+        {
+            value = "";
+        }
+        next = braced ? nameEnd + 1 : nameEnd;
+    }
+
+    appendExpansion(word, value, strlen(value), end - next + 1);
+    return next;
+};
+
+int splitFields = 0;  // Whether wordValue splits unquoted command substitutions into fields (command words only)
+size_t splitLength = 0;  // Length of the last word wordValue split, its fields end with null bytes (0 if not split)
+
+// Splits the output of an unquoted command substitution appended to word from start on: every space,
+// tab or newline ends a field, marked with a null byte (empty fields are dropped by addFields)
+// Returns whether the output had a separator
+int splitSubstitution(struct wordBuffer *word, size_t start)
+{
+    int split = 0;
+    size_t i;
+    for (i = start; i < word->length; i++)
+    {
+        if (word->data[i] == ' ' || word->data[i] == '\t' || word->data[i] == '\n')
+        {
+            word->data[i] = '\0';
+            split = 1;
+        }
+    }
+    return split;
+};
+
+// Copies a word token into the line arena in a single pass, removing its quotes and backslash
+// escapes and expanding parameters outside single quotes
+// With splitFields set, unquoted command substitutions are split into fields (see splitLength)
+// Returns NULL if an unquoted word expands to nothing, so it can be dropped like in other shells
+char *wordValue(const char *line, struct token *tok)
+{
+    // The substitutions run commands that parse words of their own, so the flags are kept locally
+    int splitting = splitFields;
+    int split = 0;
+    const char *p = line + tok->start;
+    const char *end = p + tok->length;
+    splitLength = 0;
+    if (tok->quoted == 0 && tok->expand == 0)
+    {
+        return arenaStrndup(&lineArena, p, tok->length);
+    }
+
+    // Literal text never makes a word longer than its token, only expansions grow it
+    struct wordBuffer word;
+    word.capacity = tok->length + 1;
+    word.data = arenaAlloc(&lineArena, word.capacity);
+    word.length = 0;
+    while (p < end)
+    {
+        if (*p == '\\')
+        {
+            word.data[word.length++] = p[1];
+            p += 2;
+        }
+        else if (*p == '\'')
+        {
+            // Single quotes keep everything up to the closing quote literally
+            p += 1;
+            while (*p != '\'')
+            {
+                word.data[word.length++] = *p++;
+            }
+            p += 1;
+        }
+        else if (*p == '"')
+        {
+            // Double quotes only treat a backslash before ", \, $ or ` as an escape
+            p += 1;
+            while (*p != '"')
+            {
+                if (*p == '$')
+                {
+                    p = expandParameter(p, end, &word);
+                    continue;
+                }
+                if (*p == '`')
+                {
+                    p = expandSubstitution(p, end, &word);
+                    continue;
+                }
+                if (*p == '\\' && (p[1] == '"' || p[1] == '\\' || p[1] == '$' || p[1] == '`'))
+                {
+                    p += 1;
+                }
+                word.data[word.length++] = *p++;
+            }
+            p += 1;
+        }
+        else if (*p == '$' || *p == '`')
+        {
+            size_t start = word.length;
+            int substitution = *p == '`' || p[1] == '(';
+            p = *p == '$' ? expandParameter(p, end, &word) : expandSubstitution(p, end, &word);
+            if (substitution != 0 && splitting != 0 && splitSubstitution(&word, start) != 0)
+            {
+                split = 1;
+            }
+        }
+        else
+        {
+            word.data[word.length++] = *p++;
+        }
+    }
+    splitLength = split != 0 ? word.length : 0;
+    if (word.length == 0 && tok->quoted == 0)
+    {
+        return NULL;
+    }
+    word.data[word.length] = '\0';
+    return word.data;
+};
+
+// Expands a here-document body: parameters, command substitutions, and a backslash escapes $, ` or
+// another backslash (quotes are ordinary characters, a backslash before a newline joins the lines)
+char *expandDocument(char *body)
+{
+    const char *p = body;
+    const char *end = body + strlen(body);
+    struct wordBuffer text;
+    text.capacity = end - p + 1;
+    text.data = arenaAlloc(&lineArena, text.capacity);
+    text.length = 0;
+    while (p < end)
+    {
+        if (*p == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '\\'))
+        {
+            text.data[text.length++] = p[1];
+            p += 2;
+        }
+        else if (*p == '\\' && p[1] == '\n')
+        {
+            p += 2;
+        }
+        // Substitutions have to end on the line they start on
+        else if ((*p == '`' || (*p == '$' && p[1] == '(')) && skipSubstitution(p) != NULL)
+        {
+            p = expandSubstitution(p, end, &text);
+        }
+        else if (*p == '$' && p[1] != '(')
+        {
+            p = expandParameter(p, end, &text);
+        }
+        else
+        {
+            text.data[text.length++] = *p++;
+        }
+    }
+    text.data[text.length] = '\0';
+    return text.data;
+};
+
+// Returns the text of the here-document whose delimiter word is at delimiter in the command line,
+// expanded unless its delimiter was quoted, or NULL if its body was not read
+char *hereDocumentText(const char *delimiter)
+{
+    struct hereDocument *document;
+    for (document = hereDocuments; document != NULL; document = document->next)
+    {
+        if (document->delimiter == linePosition(delimiter))
+        {
+            return document->expand != 0 ? expandDocument(document->body) : document->body;
+        }
+    }
+    return NULL;
+};
+
+// Prints a syntax error naming the offending token
+void syntaxError(const char *line, struct token *tok)
+{
+    if (tok->type == TOKEN_END)
+    {
+        printf("syntax error near unexpected token `newline'\n");
+    }
+    else if (tok->type == TOKEN_ERROR)
+    {
+        printf("syntax error: unterminated quote or escape\n");
+    }
+    else
+    {
+        printf("syntax error near unexpected token `%.*s'\n", (int)tok->length, line + tok->start);
+    }
+    fflush(stdout);
+};
+
+// Allocates an empty command structure from the line arena
+struct command *newCommandStage()
+{
+    struct command *currCommand = arenaAlloc(&lineArena, sizeof(struct command));
+    currCommand->name = NULL;
+    currCommand->redirections = NULL;
+    currCommand->redirectionLink = &currCommand->redirections;
+    currCommand->mode = 0;
+    currCommand->timed = 0;
+    currCommand->limits = NULL;
+    currCommand->argCount = 0;
+    currCommand->argCapacity = COMMAND_INLINE_ARGV;
+    currCommand->argv = currCommand->inlineArgv;
+    currCommand->argv[0] = NULL;
+    currCommand->arguments = currCommand->argv + 1;
+    currCommand->arguments[0] = NULL;
+    currCommand->assignments = NULL;
+    currCommand->assignmentCount = 0;
+    currCommand->assignmentCapacity = 0;
+    currCommand->next = NULL;
+    return currCommand;
+};
+
+// Appends an argument to a command, moving argv to a larger arena block when it is full
+// (the kernel enforces ARG_MAX when the command is spawned)
+void addArgument(struct command *currCommand, char *argument)
+{
+    if (currCommand->argCount + 2 >= currCommand->argCapacity)
+    {
+        int capacity = currCommand->argCapacity * 2;
+        char **argv = arenaAlloc(&lineArena, capacity * sizeof(char *));
+        memcpy(argv, currCommand->argv, (currCommand->argCount + 1) * sizeof(char *));
+        currCommand->argv = argv;
+        currCommand->arguments = argv + 1;
+        currCommand->argCapacity = capacity;
+    }
+    currCommand->arguments[currCommand->argCount] = argument;
+    currCommand->argCount += 1;
+    currCommand->arguments[currCommand->argCount] = NULL;
+};
+
+// Adds the fields of a word split by wordValue as the command's name and arguments, skipping empty ones
+void addFields(struct command *currCommand, char *value, size_t length)
+{
+    char *field = value;
+    char *end = value + length;
+    while (field < end)
+    {
+        size_t fieldLength = strlen(field);
+        if (fieldLength == 0)
+        {
+            field += 1;
+            continue;
+        }
+        if (currCommand->name == NULL)
+        {
+            currCommand->name = field;
+            currCommand->argv[0] = field;
+        }
+        else
+        {
+            addArgument(currCommand, field);
+        }
+        field += fieldLength + 1;
+    }
+};
+
+// Appends a NAME=value word written before a command's name
+void addAssignment(struct command *currCommand, char *assignment)
+{
+    if (currCommand->assignmentCount == currCommand->assignmentCapacity)
+    {
+        int capacity = currCommand->assignmentCapacity == 0 ? 4 : currCommand->assignmentCapacity * 2;
+        char **assignments = arenaAlloc(&lineArena, capacity * sizeof(char *));
+        memcpy(assignments, currCommand->assignments, currCommand->assignmentCount * sizeof(char *));
+        currCommand->assignments = assignments;
+        currCommand->assignmentCapacity = capacity;
+    }
+    currCommand->assignments[currCommand->assignmentCount] = assignment;
+    currCommand->assignmentCount += 1;
+};
+
+// Appends a redirection to the end of a command's list
+void linkRedirection(struct command *currCommand, enum redirectionType type, int fd, char *fileName, int sourceFd)
+{
+    struct redirection *redirect = arenaAlloc(&lineArena, sizeof(struct redirection));
+    redirect->type = type;
+    redirect->fd = fd;
+    redirect->fileName = fileName;
+    redirect->sourceFd = sourceFd;
+    redirect->next = NULL;
+    *currCommand->redirectionLink = redirect;
+    currCommand->redirectionLink = &redirect->next;
+};
+
+// Adds the redirections written as the operator tok followed by word, returns -1 if they are invalid
+int addRedirection(struct command *currCommand, struct token *tok, char *word)
+{
+    int fd = tok->fd;
+    if (fd >= SHELL_FD_BASE)
+    {
+        printf("%d: bad file descriptor\n", fd);
+        fflush(stdout);
+        return -1;
+    }
+    switch (tok->type)
+    {
+        case TOKEN_INPUT:
+            linkRedirection(currCommand, REDIRECT_INPUT, fd == -1 ? 0 : fd, word, -1);
+            return 0;
+        case TOKEN_OUTPUT:
+            linkRedirection(currCommand, REDIRECT_OUTPUT, fd == -1 ? 1 : fd, word, -1);
+            return 0;
+        case TOKEN_APPEND:
+            linkRedirection(currCommand, REDIRECT_APPEND, fd == -1 ? 1 : fd, word, -1);
+            return 0;
+        case TOKEN_READWRITE:
+            linkRedirection(currCommand, REDIRECT_READWRITE, fd == -1 ? 0 : fd, word, -1);
+            return 0;
+        case TOKEN_DUPLICATE_INPUT:
+        case TOKEN_DUPLICATE_OUTPUT:
+            if (fd == -1)
+            {
+                fd = tok->type == TOKEN_DUPLICATE_INPUT ? 0 : 1;
+            }
+            // Duplicates a descriptor, or closes it for -
+            if (strcmp(word, "-") == 0)
+            {
+                linkRedirection(currCommand, REDIRECT_CLOSE, fd, NULL, -1);
+                return 0;
+            }
+            if (word[0] != '\0' && strspn(word, "0123456789") == strlen(word))
+            {
+                // Descriptors from SHELL_FD_BASE up belong to the shell (its self-pipe, history, ...)
+                if (strlen(word) > 9 || atoi(word) >= SHELL_FD_BASE)
+                {
+                    printf("%s: bad file descriptor\n", word);
+                    fflush(stdout);
+                    return -1;
+                }
+                linkRedirection(currCommand, REDIRECT_DUPLICATE, fd, NULL, atoi(word));
+                return 0;
+            }
+            // >&file without a descriptor number is the same as &>file
+            if (tok->type == TOKEN_DUPLICATE_OUTPUT && tok->fd == -1)
+            {
+                linkRedirection(currCommand, REDIRECT_OUTPUT, 1, word, -1);
+                linkRedirection(currCommand, REDIRECT_DUPLICATE, 2, NULL, 1);
+                return 0;
+            }
+            printf("%s: ambiguous redirect\n", word);
+            fflush(stdout);
+            return -1;
+        case TOKEN_HEREDOC:
+        case TOKEN_HEREDOC_STRIP:
+        case TOKEN_HERESTRING:
+            linkRedirection(currCommand, REDIRECT_DOCUMENT, fd == -1 ? 0 : fd, word, -1);
+            return 0;
+        case TOKEN_OUTPUT_ALL:
+        case TOKEN_APPEND_ALL:
+            // Sends both stdout and stderr to the file
+            linkRedirection(currCommand, tok->type == TOKEN_OUTPUT_ALL ? REDIRECT_OUTPUT : REDIRECT_APPEND, 1, word, -1);
+            linkRedirection(currCommand, REDIRECT_DUPLICATE, 2, NULL, 1);
+            return 0;
+        default:
+            return -1;
+    }
+};
+
+// Parses the pipeline starting at *pos up to the list operator that ends it (;, &, &&, || or the end
+// of the line), which is left in tok. Stages separated by | are linked through next
+// Words are only expanded if expand is set, otherwise just the structure of the pipeline is checked
+// Returns NULL if the pipeline is empty, or on error with tok->type set to TOKEN_ERROR
+struct command *createCommand(char *line, size_t *pos, struct token *tok, int expand)
+{
+    struct command *firstCommand = NULL;
+    struct command **lastLink = &firstCommand;  // Where the next finished stage is linked in
+    struct command *currCommand = NULL;
+    struct command *stage;
+    int mode = 0;
+    int timed = 0;
+
+    while (nextToken(line, pos, tok) != TOKEN_END && tok->type != TOKEN_SEMICOLON && tok->type != TOKEN_BACKGROUND &&
+    tok->type != TOKEN_AND && tok->type != TOKEN_OR)
+    {
+        size_t peek = *pos;
+        struct token nextTok;
+
+        // Leading time keyword, times the whole pipeline (time alone runs a command named time)
+        if (tok->type == TOKEN_WORD && firstCommand == NULL && currCommand == NULL && timed == 0 &&
+        tok->length == 4 && strncmp(line + tok->start, "time", 4) == 0 && nextToken(line, &peek, &nextTok) == TOKEN_WORD)
+        {
+            timed = 1;
+        }
+        // Token for command name or argument
+        else if (tok->type == TOKEN_WORD)
+        {
+            // Words of the form NAME=value before the name are variable assignments, they are not split
+            size_t length = nameLength(line + tok->start);
+            int assignment = (currCommand == NULL || currCommand->name == NULL) && length > 0 &&
+                line[tok->start + length] == '=';
+            splitFields = assignment == 0;
+            char *value = expand != 0 ? wordValue(line, tok) : "";
+            size_t fieldsLength = expand != 0 ? splitLength : 0;
+            splitFields = 0;
+            if (currCommand == NULL)
+            {
+                currCommand = newCommandStage();
+            }
+            if (value == NULL)
+            {
+                continue;
+            }
+            if (assignment != 0)
+            {
+                addAssignment(currCommand, value);
+            }
+            else if (fieldsLength != 0)
+            {
+                addFields(currCommand, value, fieldsLength);
+            }
+            else if (currCommand->name == NULL)
+            {
+                currCommand->name = value;
+                currCommand->argv[0] = currCommand->name;
+            }
+            else
+            {
+                addArgument(currCommand, value);
+            }
+        }
+        // Token for a redirection, followed by the file name or descriptor it uses
+        else if (tok->type == TOKEN_INPUT || tok->type == TOKEN_OUTPUT || tok->type == TOKEN_APPEND ||
+        tok->type == TOKEN_READWRITE || tok->type == TOKEN_DUPLICATE_INPUT || tok->type == TOKEN_DUPLICATE_OUTPUT ||
+        tok->type == TOKEN_OUTPUT_ALL || tok->type == TOKEN_APPEND_ALL || tok->type == TOKEN_HEREDOC ||
+        tok->type == TOKEN_HEREDOC_STRIP || tok->type == TOKEN_HERESTRING)
+        {
+            struct token fileToken;
+            if (nextToken(line, pos, &fileToken) != TOKEN_WORD)
+            {
+                syntaxError(line, &fileToken);
+                tok->type = TOKEN_ERROR;
+                return NULL;
+            }
+            char *fileName = "-";
+            if (expand != 0 && (tok->type == TOKEN_HEREDOC || tok->type == TOKEN_HEREDOC_STRIP))
+            {
+                fileName = hereDocumentText(line + fileToken.start);
+                if (fileName == NULL)
+                {
+                    printf("%.*s: here-document has no body\n", (int)fileToken.length, line + fileToken.start);
+                    fflush(stdout);
+                    tok->type = TOKEN_ERROR;
+                    return NULL;
+                }
+            }
+            // A here-string is the expanded word followed by a newline
+            else if (expand != 0 && tok->type == TOKEN_HERESTRING)
+            {
+                char *value = wordValue(line, &fileToken);
+                size_t length = value != NULL ? strlen(value) : 0;
+                fileName = arenaAlloc(&lineArena, length + 2);
+                memcpy(fileName, value != NULL ? value : "", length);
+                fileName[length] = '\n';
+                fileName[length + 1] = '\0';
+            }
+            else if (expand != 0)
+            {
+                fileName = wordValue(line, &fileToken);
+            }
+            if (fileName == NULL)
+            {
+                printf("%.*s: ambiguous redirect\n", (int)fileToken.length, line + fileToken.start);
+                fflush(stdout);
+                tok->type = TOKEN_ERROR;
+                return NULL;
+            }
+            if (currCommand == NULL)
+            {
+                currCommand = newCommandStage();
+            }
+            if (addRedirection(currCommand, tok, fileName) == -1)
+            {
+                tok->type = TOKEN_ERROR;
+                return NULL;
+            }
+        }
+        // Token for pipeline, the next word starts the next stage
+        else if (tok->type == TOKEN_PIPE && currCommand != NULL && currCommand->name != NULL)
+        {
+            *lastLink = currCommand;
+            lastLink = &currCommand->next;
+            currCommand = NULL;
+        }
+        // Any other operator is not supported here
+        else
+        {
+            syntaxError(line, tok);
+            tok->type = TOKEN_ERROR;
+            return NULL;
+        }
+    }
+
+    // Empty pipeline, the caller decides whether the operator after it is allowed
+    if (firstCommand == NULL && currCommand == NULL)
+    {
+        return NULL;
+    }
+    // Every stage after a | needs a command name, a pipeline of one stage may only have assignments
+    // (which set shell variables), redirections or words that expanded to nothing
+    if (currCommand == NULL || (currCommand->name == NULL && firstCommand != NULL))
+    {
+        syntaxError(line, tok);
+        tok->type = TOKEN_ERROR;
+        return NULL;
+    }
+    *lastLink = currCommand;
+    firstCommand->timed = timed;
+
+    // Only runs pipelines ended by & in the background if foreground-only mode is OFF
+    if (tok->type == TOKEN_BACKGROUND && foregroundMode == 0)
+    {
+        mode = 1;
+    }
+
+    // Every stage runs in the mode given at the end of the pipeline
+    for (stage = firstCommand; stage != NULL; stage = stage->next)
+    {
+        stage->mode = mode;
+    }
+    return firstCommand;
+};
+
+// Parses an input line into a list of pipelines separated by ;, &, && and ||, checking its syntax
+// Only the first pipeline is expanded now, once the whole line is checked so no command substitution
+// runs on a rejected line. The others are parsed again just before they run so they see variables
+// set earlier in the list. Returns NULL if the line is blank or has a syntax error
+struct commandList *createCommandList(char *line)
+{
+    struct commandList *firstElement = NULL;
+    struct commandList **lastLink = &firstElement;  // Where the next element is linked in
+    enum tokenType connector = TOKEN_END;  // Operator after the previous pipeline
+    struct token tok;
+    size_t pos = 0;
+
+    while (1)
+    {
+        size_t start = pos;
+        struct command *pipeline = createCommand(line, &pos, &tok, 0);
+        if (pipeline == NULL)
+        {
+            if (tok.type == TOKEN_ERROR)
+            {
+                return NULL;
+            }
+            // Only the end of the line may follow ; or &, and && or || need a pipeline after them
+            if (tok.type != TOKEN_END || connector == TOKEN_AND || connector == TOKEN_OR)
+            {
+                syntaxError(line, &tok);
+                return NULL;
+            }
+            break;
+        }
+
+        // Keeps the pipeline's text for job listings, with the & that puts it in the background
+        while (line[start] == ' ' || line[start] == '\t')
+        {
+            start++;
+        }
+        size_t end = tok.type == TOKEN_BACKGROUND ? tok.start + tok.length : tok.start;
+        while (end > start && (line[end - 1] == ' ' || line[end - 1] == '\t' || line[end - 1] == '\n'))
+        {
+            end--;
+        }
+
+        struct commandList *element = arenaAlloc(&lineArena, sizeof(struct commandList));
+        element->start = start;
+        element->pipeline = NULL;
+        element->connector = tok.type;
+        element->text = arenaStrndup(&lineArena, line + start, end - start);
+        element->next = NULL;
+        *lastLink = element;
+        lastLink = &element->next;
+        connector = tok.type;
+        if (tok.type == TOKEN_END)
+        {
+            break;
+        }
+    }
+
+    if (firstElement != NULL)
+    {
+        pos = firstElement->start;
+        firstElement->pipeline = createCommand(line, &pos, &tok, 1);
+        if (firstElement->pipeline == NULL)
+        {
+            return NULL;
+        }
+    }
+    return firstElement;
+};
+
+// Returns the list element to run after element, skipping pipelines short-circuited by && and ||
+// on the status of the last pipeline that ran
+struct commandList *nextCommand(struct commandList *element)
+{
+    int success = WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0;
+    enum tokenType connector = element->connector;
+    struct commandList *next = element->next;
+    while (next != NULL && ((connector == TOKEN_AND && success == 0) || (connector == TOKEN_OR && success != 0)))
+    {
+        connector = next->connector;
+        next = next->next;
+    }
+    return next;
+};
+
+// Entry in the executable lookup cache, maps a command name to its resolved path
+struct pathEntry
+{
+    char *name;
+    char *path;
+    int hits;  // Number of times the remembered path has been used
+    struct pathEntry *next;
+};
+
+struct pathEntry *pathCache[PATH_CACHE_SIZE];  // Hash table of remembered command locations
+char *pathCacheVar = NULL;  // Value of PATH the cache was filled under
+int pathWatch = -1;  // inotify descriptor watching the PATH directories (-1 disables caching)
+
+// Forgets all remembered command locations
+void clearPathCache()
+{
+    int i;
+    for (i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+        while (pathCache[i] != NULL)
+        {
+            struct pathEntry *entry = pathCache[i];
+            pathCache[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+};
+
+// Invalidates the cache if PATH changed or a watched directory gained, lost or renamed an entry
+void checkPathCache()
+{
+    char *pathVar = getVariable("PATH");
+    if (pathVar == NULL)
+    {
+        pathVar = DEFAULT_PATH;
+    }
+
+    // PATH changed, so the cache is flushed and the new directories are watched instead
+    if (pathCacheVar == NULL || strcmp(pathCacheVar, pathVar) != 0)
+    {
+        clearPathCache();
+        free(pathCacheVar);
+        pathCacheVar = strdup(pathVar);
+        if (pathWatch != -1)
+        {
+            close(pathWatch);
+        }
+        pathWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (pathWatch == -1)
+        {
+            return;
+        }
+        pathWatch = moveDescriptor(pathWatch);
+
+        // Adds a watch for every directory listed in PATH
+        char *dirs = strdup(pathVar);
+        char *saveptr = dirs;
+        char *dir;
+        while ((dir = strsep(&saveptr, ":")) != NULL)
+        {
+            // Relative entries depend on the current directory, so caching is disabled for them
+            if (*dir != '/')
+            {
+                close(pathWatch);
+                pathWatch = -1;
+                break;
+            }
+            inotify_add_watch(pathWatch, dir,
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+        }
+        free(dirs);
+        return;
+    }
+
+    // Drains pending directory events, any event flushes the cache
+    char events[4096];
+    int changed = 0;
+    while (pathWatch != -1 && read(pathWatch, events, sizeof(events)) > 0)
+    {
+        changed = 1;
+    }
+    if (changed)
+    {
+        clearPathCache();
+    }
+};
+
+// Searches PATH for an executable, returns a newly allocated path or NULL if not found
+char *searchPath(char *name)
+{
+    char *pathVar = getVariable("PATH");
+    if (pathVar == NULL)
+    {
+        pathVar = DEFAULT_PATH;
+    }
+
+    char candidate[PATH_MAX];
+    struct stat fileInfo;
+    char *start = pathVar;
+    while (1)
+    {
+        // Builds "dir/name" for the next PATH entry (an empty entry means the current directory)
+        char *end = strchrnul(start, ':');
+        int dirLen = end - start;
+        if (dirLen == 0)
+        {
+            snprintf(candidate, sizeof(candidate), "./%s", name);
+        }
+        else
+        {
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", dirLen, start, name);
+        }
+
+        // Returns the first regular file the user may execute
+        if (access(candidate, X_OK) == 0 && stat(candidate, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode))
+        {
+            return strdup(candidate);
+        }
+        if (*end == '\0')
+        {
+            return NULL;
+        }
+        start = end + 1;
+    }
+};
+
+// Resolves a command name to an executable path, remembering the result for later lookups
+char *resolvePath(char *name)
+{
+    // Names containing a slash are used as given
+    if (strchr(name, '/') != NULL)
+    {
+        return name;
+    }
+
+    checkPathCache();
+
+    // Without a working directory watch nothing can be remembered safely
+    if (pathWatch == -1)
+    {
+        static char *uncached = NULL;
+        free(uncached);
+        uncached = searchPath(name);
+        return uncached;
+    }
+
+    // Returns the remembered location if there is one
+    unsigned int bucket = hashString(name, strlen(name)) % PATH_CACHE_SIZE;
+    struct pathEntry *entry;
+    for (entry = pathCache[bucket]; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->name, name) == 0)
+        {
+            entry->hits += 1;
+            return entry->path;
+        }
+    }
+
+    // Else, searches PATH and remembers the result
+    char *path = searchPath(name);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    entry = malloc(sizeof(struct pathEntry));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    entry->next = pathCache[bucket];
+    pathCache[bucket] = entry;
+    return path;
+};
+
+// Prints remembered command locations in the same layout as bash's hash builtin
+void printPathCache()
+{
+    int i;
+    int empty = 1;
+    checkPathCache();
+    for (i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+        struct pathEntry *entry;
+        for (entry = pathCache[i]; entry != NULL; entry = entry->next)
+        {
+            if (empty)
+            {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+    if (empty)
+    {
+        printf("hash: hash table empty\n");
+    }
+    fflush(stdout);
+};
+
+int traceFd = -1;  // File trace events are written to (-1 when SMALLSH_TRACE is not set)
+int traceLines = 0;  // Whether events are written as JSON Lines rather than a Chrome trace array
+char *traceBuffer = NULL;  // Events not yet written to traceFd
+size_t traceLength = 0;
+size_t traceCapacity = 0;
+
+// Returns the monotonic time in microseconds, the unit of trace timestamps
+double traceNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+};
+
+// Writes all buffered trace events in one batch
+void traceFlush()
+{
+    size_t written = 0;
+    while (traceFd != -1 && written < traceLength)
+    {
+        ssize_t result = write(traceFd, traceBuffer + written, traceLength - written);
+        if (result == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+    traceLength = 0;
+};
+
+// Makes room for length more bytes of events, writing out the buffer first if it is full
+void traceReserve(size_t length)
+{
+    if (traceLength + length > traceCapacity)
+    {
+        traceFlush();
+    }
+    if (length > traceCapacity)
+    {
+        traceCapacity = length;
+        traceBuffer = realloc(traceBuffer, traceCapacity);
+    }
+};
+
+// Appends formatted text to the trace buffer
+void traceFormat(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    traceReserve(length + 1);
+    va_start(args, format);
+    vsnprintf(traceBuffer + traceLength, length + 1, format, args);
+    va_end(args);
+    traceLength += length;
+};
+
+// Appends a string as a quoted JSON string
+void traceString(const char *str)
+{
+    traceReserve(strlen(str) * 6 + 2);
+    char *insert_point = traceBuffer + traceLength;
+    *insert_point++ = '"';
+    for (; *str != '\0'; str++)
+    {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+        {
+            *insert_point++ = '\\';
+            *insert_point++ = c;
+        }
+        else if (c < 0x20)
+        {
+            insert_point += sprintf(insert_point, "\\u%04x", c);
+        }
+        else
+        {
+            *insert_point++ = c;
+        }
+    }
+    *insert_point++ = '"';
+    traceLength = insert_point - traceBuffer;
+};
+
+// Starts a trace event on the track of tid and opens its args object
+// A negative duration records an instant event, otherwise a complete event that began at start
+void traceBegin(const char *name, pid_t tid, double start, double duration)
+{
+    if (duration < 0)
+    {
+        traceFormat("{\"name\":\"%s\",\"cat\":\"smallsh\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,", name, start);
+    }
+    else
+    {
+        traceFormat("{\"name\":\"%s\",\"cat\":\"smallsh\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,", name, start, duration);
+    }
+    traceFormat("\"pid\":%s,\"tid\":%d,\"args\":{", shellPidString, (int)tid);
+};
+
+// Closes an event started by traceBegin
+void traceEnd()
+{
+    traceFormat(traceLines != 0 ? "}}\n" : "}},\n");
+};
+
+// Appends a wait status to an event's args as exit or signal
+void traceStatus(int status)
+{
+    if (WIFEXITED(status))
+    {
+        traceFormat("\"exit\":%d", WEXITSTATUS(status));
+    }
+    else if (WIFSIGNALED(status))
+    {
+        traceFormat("\"signal\":%d", WTERMSIG(status));
+    }
+    else if (WIFSTOPPED(status))
+    {
+        traceFormat("\"stopped\":%d", WSTOPSIG(status));
+    }
+    else
+    {
+        traceFormat("\"continued\":true");
+    }
+};
+
+// Starts tracing to the file named by SMALLSH_TRACE, as JSON Lines if the name ends in .jsonl
+// and otherwise as a Chrome trace_event array that Perfetto and chrome://tracing can load
+void initTrace()
+{
+    char *tracePath = getVariable("SMALLSH_TRACE");
+    if (tracePath == NULL || tracePath[0] == '\0')
+    {
+        return;
+    }
+    traceFd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (traceFd == -1)
+    {
+        perror(tracePath);
+        return;
+    }
+    traceFd = moveDescriptor(traceFd);
+    size_t length = strlen(tracePath);
+    traceLines = length > 6 && strcmp(tracePath + length - 6, ".jsonl") == 0;
+    traceCapacity = TRACE_BUFFER_SIZE;
+    traceBuffer = malloc(traceCapacity);
+
+    // The array is left unterminated, which trace viewers accept, so events can be appended until exit
+    if (traceLines == 0)
+    {
+        traceFormat("[\n");
+    }
+    traceFormat("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%s,\"tid\":%s,\"args\":{\"name\":\"smallsh\"",
+        shellPidString, shellPidString);
+    traceEnd();
+    atexit(traceFlush);
+};
+
+// Records the parse of an input line, which includes expanding its words and planning redirections
+void traceParse(char *line, struct command *pipeline, double start)
+{
+    double end = traceNow();
+    int stages = 0;
+    struct command *stage;
+    for (stage = pipeline; stage != NULL; stage = stage->next)
+    {
+        stages += 1;
+    }
+    traceBegin("parse", getpid(), start, end - start);
+    traceFormat("\"line\":");
+    traceString(line);
+    traceFormat(",\"stages\":%d,\"background\":%s", stages, pipeline != NULL && pipeline->mode != 0 ? "true" : "false");
+    traceEnd();
+};
+
+// Records the spawn of a pipeline stage with its argv and redirections, and the error if exec failed
+void traceSpawn(struct command *cmd, char *path, pid_t pid, int result, double start)
+{
+    char *operators[] = {"<", ">", ">>", "<>", ">&", ">&-", "<<"};
+    struct redirection *redirect;
+    int i;
+    traceBegin("spawn", result == 0 ? pid : getpid(), start, traceNow() - start);
+    traceFormat("\"pid\":%d,\"path\":", result == 0 ? (int)pid : -1);
+    traceString(path != NULL ? path : cmd->name);
+    traceFormat(",\"argv\":[");
+    for (i = 0; cmd->argv[i] != NULL; i++)
+    {
+        traceFormat(i == 0 ? "" : ",");
+        traceString(cmd->argv[i]);
+    }
+    traceFormat("],\"redirections\":[");
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        traceFormat("%s{\"fd\":%d,\"op\":\"%s\"", redirect == cmd->redirections ? "" : ",", redirect->fd,
+            operators[redirect->type]);
+        if (redirect->type == REDIRECT_DOCUMENT)
+        {
+            traceFormat(",\"length\":%zu", strlen(redirect->fileName));
+        }
+        else if (redirect->fileName != NULL)
+        {
+            traceFormat(",\"file\":");
+            traceString(redirect->fileName);
+        }
+        else if (redirect->type == REDIRECT_DUPLICATE)
+        {
+            traceFormat(",\"source\":%d", redirect->sourceFd);
+        }
+        traceFormat("}");
+    }
+    traceFormat("]");
+    if (result != 0)
+    {
+        traceFormat(",\"error\":");
+        traceString(strerror(result));
+    }
+    traceEnd();
+};
+
+// Records a builtin run inside smallsh, with its arguments and exit value
+void traceBuiltin(struct command *cmd, int exitValue, double start)
+{
+    int i;
+    traceBegin("builtin", getpid(), start, traceNow() - start);
+    traceFormat("\"argv\":[");
+    for (i = 0; cmd->argv[i] != NULL; i++)
+    {
+        traceFormat(i == 0 ? "" : ",");
+        traceString(cmd->argv[i]);
+    }
+    traceFormat("],");
+    traceStatus(W_EXITCODE(exitValue, 0));
+    traceEnd();
+};
+
+// Closes the files the parent opened for a command's redirections
+void closeRedirections(struct command *cmd)
+{
+    struct redirection *redirect;
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        if (redirect->fileName != NULL && redirect->sourceFd != -1)
+        {
+            close(redirect->sourceFd);
+            redirect->sourceFd = -1;
+        }
+    }
+};
+
+// Writes all of a buffer, retrying short writes and interrupted calls, returns 0 or -1 on errors
+int writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+};
+
+// Returns a descriptor to read a here-document's text from: a pipe when the text fits in one without
+// blocking, otherwise a memfd (neither touches the filesystem). Returns -1 if neither can be made
+int openDocument(const char *text)
+{
+    size_t length = strlen(text);
+    int documentPipe[2];
+    if (length <= PIPE_BUF)
+    {
+        if (pipe2(documentPipe, O_CLOEXEC) == -1)
+        {
+            return -1;
+        }
+        int result = writeAll(documentPipe[1], text, length);
+        close(documentPipe[1]);
+        if (result == -1)
+        {
+            close(documentPipe[0]);
+            return -1;
+        }
+        return documentPipe[0];
+    }
+
+    int fd = memfd_create("smallsh-heredoc", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (writeAll(fd, text, length) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+};
+
+// Opens the files of a command's redirections in the parent (close-on-exec, in sourceFd)
+// Returns 0, or -1 after reporting the file that could not be opened and closing the others
+int openRedirections(struct command *cmd)
+{
+    struct redirection *redirect;
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        if (redirect->type == REDIRECT_DOCUMENT)
+        {
+            redirect->sourceFd = openDocument(redirect->fileName);
+            if (redirect->sourceFd == -1)
+            {
+                perror("here-document");
+                closeRedirections(cmd);
+                return -1;
+            }
+            redirect->sourceFd = moveDescriptor(redirect->sourceFd);
+            continue;
+        }
+        int flags = O_RDONLY;
+        if (redirect->type == REDIRECT_OUTPUT)
+        {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        else if (redirect->type == REDIRECT_APPEND)
+        {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        }
+        else if (redirect->type == REDIRECT_READWRITE)
+        {
+            flags = O_RDWR | O_CREAT;
+        }
+        else if (redirect->type != REDIRECT_INPUT)
+        {
+            continue;
+        }
+        redirect->sourceFd = open(redirect->fileName, flags | O_CLOEXEC, 0666);
+        if (redirect->sourceFd == -1)
+        {
+            printf("cannot open %s for %s\n", redirect->fileName, flags == O_RDONLY ? "input" : "output");
+            fflush(stdout);
+            closeRedirections(cmd);
+            return -1;
+        }
+        redirect->sourceFd = moveDescriptor(redirect->sourceFd);
+    }
+    return 0;
+};
+
+// Returns the environment for a command, with the assignments written before its name applied
+// (those copies live in the line arena, the common case reuses the shared environment)
+char **spawnEnvironment(struct command *cmd)
+{
+    char **env = commandEnvironment();
+    if (cmd->assignmentCount == 0)
+    {
+        return env;
+    }
+
+    // Copies the shared environment without the variables being overridden, then adds the assignments
+    int count = 0;
+    int i;
+    while (env[count] != NULL)
+    {
+        count++;
+    }
+    char **envp = arenaAlloc(&lineArena, (count + cmd->assignmentCount + 1) * sizeof(char *));
+    int used = 0;
+    char **entry;
+    for (entry = env; *entry != NULL; entry++)
+    {
+        size_t length = strchr(*entry, '=') - *entry + 1;
+        for (i = 0; i < cmd->assignmentCount; i++)
+        {
+            if (strncmp(*entry, cmd->assignments[i], length) == 0)
+            {
+                break;
+            }
+        }
+        if (i == cmd->assignmentCount)
+        {
+            envp[used++] = *entry;
+        }
+    }
+    for (i = 0; i < cmd->assignmentCount; i++)
+    {
+        envp[used++] = cmd->assignments[i];
+    }
+    envp[used] = NULL;
+    return envp;
+};
+
+// Returns whether a command must run with resource limits or in a cgroup, which posix_spawn cannot set up
+int limitedCommand(struct jobLimits *limits)
+{
+    return limits->addressSpace != 0 || limits->cpuSeconds != 0 || limits->openFiles != 0 || spawnCgroup != NULL;
+};
+
+// Applies resource limits to the calling process, run in a forked child before exec
+// A limit above the hard limit smallsh was given is lowered to it. The CPU limit keeps a second between
+// its soft and hard limits, so processes get SIGXCPU before they are killed
+void applyLimits(struct jobLimits *limits)
+{
+    int resources[] = {RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE};
+    rlim_t values[] = {limits->addressSpace, limits->cpuSeconds, limits->openFiles};
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        struct rlimit limit;
+        if (values[i] == 0 || getrlimit(resources[i], &limit) == -1)
+        {
+            continue;
+        }
+        rlim_t hardLimit = resources[i] == RLIMIT_CPU ? values[i] + 1 : values[i];
+        limit.rlim_cur = values[i] < limit.rlim_max ? values[i] : limit.rlim_max;
+        limit.rlim_max = hardLimit < limit.rlim_max ? hardLimit : limit.rlim_max;
+        setrlimit(resources[i], &limit);
+    }
+};
+
+// Makes dst a copy of src in a forked child (a descriptor copied onto itself loses close-on-exec,
+// as posix_spawn's dup2 actions do)
+void childDuplicate(int src, int dst)
+{
+    if (src == dst)
+    {
+        fcntl(dst, F_SETFD, 0);
+    }
+    else
+    {
+        dup2(src, dst);
+    }
+};
+
+// Child side of spawnCommand for limited commands: sets up what the posix_spawn attributes and file
+// actions would, joins the job's cgroup and applies its limits, then runs the command. Never returns
+void execLimited(struct command *cmd, char *path, int inputPipe, int outputPipe, int nullInput, int nullOutput,
+    sigset_t *defaultSignals, sigset_t *mask, pid_t pgid)
+{
+    struct redirection *redirect;
+    int signo;
+    if (inputPipe != -1)
+    {
+        childDuplicate(inputPipe, STDIN_FILENO);
+    }
+    if (outputPipe != -1)
+    {
+        childDuplicate(outputPipe, STDOUT_FILENO);
+    }
+    if (nullInput != 0 || nullOutput != 0)
+    {
+        int devNull = open("/dev/null", nullInput != 0 ? O_RDONLY : O_WRONLY);
+        dup2(devNull, nullInput != 0 ? STDIN_FILENO : STDOUT_FILENO);
+        close(devNull);
+    }
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        if (redirect->type == REDIRECT_CLOSE)
+        {
+            close(redirect->fd);
+        }
+        else
+        {
+            childDuplicate(redirect->sourceFd, redirect->fd);
+        }
+    }
+
+    // Signals posix_spawn would reset, plus SIGCHLD whose handler writes to smallsh's self-pipe
+    for (signo = 1; signo < NSIG; signo++)
+    {
+        if (signo == SIGCHLD || sigismember(defaultSignals, signo) == 1)
+        {
+            signal(signo, SIG_DFL);
+        }
+    }
+    if (jobControl != 0)
+    {
+        setpgid(0, pgid);
+    }
+
+    // Joins the cgroup and lowers the limits before the command runs a single instruction
+    if (spawnCgroup != NULL)
+    {
+        char procsPath[PATH_MAX];
+        snprintf(procsPath, sizeof(procsPath), "%s/cgroup.procs", spawnCgroup);
+        int procsFd = open(procsPath, O_WRONLY);
+        if (procsFd != -1)
+        {
+            write(procsFd, "0", 1);
+            close(procsFd);
+        }
+    }
+    applyLimits(cmd->limits != NULL ? cmd->limits : &defaultLimits);
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    execve(path, cmd->argv, spawnEnvironment(cmd));
+    perror(cmd->name);
+    _exit(errno == ENOENT ? 127 : 126);
+};
+
+// Launches a parsed command with posix_spawn (vfork-style, no copy of the parent's page tables)
+// inputPipe/outputPipe are pipe ends to use as stdin/stdout (-1 if none), pgid is the process
+// group to join (0 starts a new group). Without job control nothing hands the terminal to a new
+// group, so children stay in smallsh's own group and pgid is ignored
+// Commands with resource limits are forked instead, so the limits are in place before exec
+// Returns the child's PID, or -1 if it could not be started
+pid_t spawnCommand(struct command *cmd, int inputPipe, int outputPipe, pid_t pgid)
+{
+    posix_spawn_file_actions_t fileActions;
+    posix_spawnattr_t spawnAttr;
+    pid_t spawnpid = -1;
+    struct redirection *redirect;
+
+    // Opens redirection files in the parent so failures are reported before anything is spawned
+    if (openRedirections(cmd) == -1)
+    {
+        return -1;
+    }
+
+    // Connects the pipe ends first, so redirections written on the command take precedence
+    posix_spawn_file_actions_init(&fileActions);
+    if (inputPipe != -1)
+    {
+        posix_spawn_file_actions_adddup2(&fileActions, inputPipe, STDIN_FILENO);
+    }
+    if (outputPipe != -1)
+    {
+        posix_spawn_file_actions_adddup2(&fileActions, outputPipe, STDOUT_FILENO);
+    }
+
+    // Background commands with only one stream redirected send the other stream to /dev/null
+    int inputRedirected = inputPipe != -1;
+    int outputRedirected = outputPipe != -1;
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        inputRedirected |= redirect->fd == STDIN_FILENO;
+        outputRedirected |= redirect->fd == STDOUT_FILENO;
+    }
+    int nullInput = cmd->mode != 0 && inputRedirected == 0 && outputRedirected != 0;
+    int nullOutput = cmd->mode != 0 && outputRedirected == 0 && inputRedirected != 0;
+    if (nullInput != 0)
+    {
+        posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    if (nullOutput != 0)
+    {
+        posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    // Applies the redirections in order (dup2 clears close-on-exec on the target descriptor)
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        if (redirect->type == REDIRECT_CLOSE)
+        {
+            posix_spawn_file_actions_addclose(&fileActions, redirect->fd);
+        }
+        else
+        {
+            posix_spawn_file_actions_adddup2(&fileActions, redirect->sourceFd, redirect->fd);
+        }
+    }
+
+    // Blocks all signals while the parent's dispositions are temporarily changed below
+    sigset_t allSignals;
+    sigset_t oldMask;
+    sigfillset(&allSignals);
+    sigprocmask(SIG_BLOCK, &allSignals, &oldMask);
+
+    // posix_spawn resets caught signals to default but keeps ignored ones, so signals the child
+    // must ignore are ignored around the spawn. Without job control that is SIGTSTP, and SIGINT
+    // for background commands (with it, their own process group keeps the terminal's signals away)
+    struct sigaction ignoreAction = {0};
+    struct sigaction oldSIGINT;
+    struct sigaction oldSIGTSTP;
+    int ignoreSignals = jobControl == 0;
+    ignoreAction.sa_handler = SIG_IGN;
+    if (ignoreSignals)
+    {
+        sigaction(SIGTSTP, &ignoreAction, &oldSIGTSTP);
+        if (cmd->mode != 0)
+        {
+            sigaction(SIGINT, &ignoreAction, &oldSIGINT);
+        }
+    }
+
+    // Foreground children take the default SIGINT action and start with the original signal mask
+    // With job control, children can be stopped and take back the terminal signals smallsh ignores
+    sigset_t defaultSignals;
+    sigemptyset(&defaultSignals);
+    if (cmd->mode == 0 || jobControl != 0)
+    {
+        sigaddset(&defaultSignals, SIGINT);
+    }
+    if (jobControl != 0)
+    {
+        sigaddset(&defaultSignals, SIGTSTP);
+        sigaddset(&defaultSignals, SIGTTIN);
+        sigaddset(&defaultSignals, SIGTTOU);
+    }
+    posix_spawnattr_init(&spawnAttr);
+    posix_spawnattr_setsigdefault(&spawnAttr, &defaultSignals);
+    posix_spawnattr_setsigmask(&spawnAttr, &oldMask);
+    posix_spawnattr_setpgroup(&spawnAttr, pgid);
+    posix_spawnattr_setflags(&spawnAttr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+        (jobControl != 0 ? POSIX_SPAWN_SETPGROUP : 0));
+
+    // Looks up the executable on PATH, names that cannot be found fail like a missing file
+    double start = traceFd != -1 ? traceNow() : 0;
+    char *path = resolvePath(cmd->name);
+    int result = ENOENT;
+    if (path != NULL && limitedCommand(cmd->limits != NULL ? cmd->limits : &defaultLimits))
+    {
+        spawnpid = fork();
+        result = spawnpid == -1 ? errno : 0;
+        if (spawnpid == 0)
+        {
+            execLimited(cmd, path, inputPipe, outputPipe, nullInput, nullOutput, &defaultSignals, &oldMask, pgid);
+        }
+
+        // The parent sets the group as well, so it is in place before the terminal is handed to it
+        if (spawnpid > 0 && jobControl != 0)
+        {
+            setpgid(spawnpid, pgid != 0 ? pgid : spawnpid);
+        }
+    }
+    else if (path != NULL)
+    {
+        result = posix_spawn(&spawnpid, path, &fileActions, &spawnAttr, cmd->argv, spawnEnvironment(cmd));
+    }
+    if (traceFd != -1)
+    {
+        traceSpawn(cmd, path, spawnpid, result, start);
+    }
+
+    // Restores the parent's handlers, then delivers anything that arrived during the spawn
+    if (ignoreSignals)
+    {
+        sigaction(SIGTSTP, &oldSIGTSTP, NULL);
+        if (cmd->mode != 0)
+        {
+            sigaction(SIGINT, &oldSIGINT, NULL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    posix_spawnattr_destroy(&spawnAttr);
+    posix_spawn_file_actions_destroy(&fileActions);
+    closeRedirections(cmd);
+
+    // posix_spawn reports exec() failures to the parent instead of the child
+    if (result != 0)
+    {
+        errno = result;
+        perror(cmd->name);
+        return -1;
+    }
+    return spawnpid;
+};
+
+// Launches every stage of a pipeline at once, connected by pipes and placed in one process group
+// Stores each stage's PID in pids (-1 if it could not be started), returns the group ID (0 if none)
+pid_t spawnPipeline(struct command *pipeline, pid_t *pids)
+{
+    pid_t pgid = 0;
+    int inputPipe = -1;
+    int stage = 0;
+    struct command *cmd;
+
+    // Larger pipe buffers can be requested through SMALLSH_PIPESIZE (in bytes)
+    char *pipeSizeVar = getVariable("SMALLSH_PIPESIZE");
+    int pipeSize = pipeSizeVar != NULL ? atoi(pipeSizeVar) : 0;
+
+    for (cmd = pipeline; cmd != NULL; cmd = cmd->next)
+    {
+        // Creates the pipe to the next stage (close-on-exec, the child gets its end through dup2)
+        int pipeDescriptors[2] = {-1, -1};
+        if (cmd->next != NULL && pipe2(pipeDescriptors, O_CLOEXEC) == -1)
+        {
+            perror("pipe()");
+            for (; cmd != NULL; cmd = cmd->next)
+            {
+                pids[stage++] = -1;
+            }
+            break;
+        }
+        if (cmd->next != NULL)
+        {
+            pipeDescriptors[0] = moveDescriptor(pipeDescriptors[0]);
+            pipeDescriptors[1] = moveDescriptor(pipeDescriptors[1]);
+        }
+        if (pipeSize > 0 && pipeDescriptors[1] != -1)
+        {
+            fcntl(pipeDescriptors[1], F_SETPIPE_SZ, pipeSize);
+        }
+
+        // The first stage started leads the process group, the rest join it
+        pids[stage] = spawnCommand(cmd, inputPipe, pipeDescriptors[1], pgid);
+        if (pgid == 0 && pids[stage] != -1)
+        {
+            pgid = pids[stage];
+        }
+        stage += 1;
+
+        // Parent keeps only the read end for the next stage
+        if (inputPipe != -1)
+        {
+            close(inputPipe);
+        }
+        if (pipeDescriptors[1] != -1)
+        {
+            close(pipeDescriptors[1]);
+        }
+        inputPipe = pipeDescriptors[0];
+    }
+    if (inputPipe != -1)
+    {
+        close(inputPipe);
+    }
+    return pgid;
+};
+
+// Output captured from a background job in joblog mode, its last JOBLOG_BUFFER_SIZE bytes in a ring buffer
+struct jobLog
+{
+    int number;  // Number of the job the output came from
+    char *commandLine;
+    int fd;  // Read end of the pipe the job writes to (-1 once the job is done and the pipe is drained)
+    char *buffer;  // Ring buffer of JOBLOG_BUFFER_SIZE bytes
+    size_t start;  // Offset of the oldest byte in buffer
+    size_t length;  // Number of bytes in buffer
+    size_t dropped;  // Bytes overwritten because the buffer was full
+    int lineStart;  // Whether the next byte read starts a line (where timestamps go)
+    struct jobLog *next;
+};
+
+struct jobLog *jobLogs = NULL;  // Captured output of background jobs, running or done (one per job number)
+int activeLogs = 0;  // Number of jobLogs still reading from their pipe
+
+// Appends bytes to a log's ring buffer, overwriting its oldest bytes once it is full
+void appendLog(struct jobLog *log, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t end = (log->start + log->length) % JOBLOG_BUFFER_SIZE;
+        size_t chunk = JOBLOG_BUFFER_SIZE - end < length ? JOBLOG_BUFFER_SIZE - end : length;
+        memcpy(log->buffer + end, data, chunk);
+        log->length += chunk;
+        if (log->length > JOBLOG_BUFFER_SIZE)
+        {
+            log->dropped += log->length - JOBLOG_BUFFER_SIZE;
+            log->start = (log->start + log->length - JOBLOG_BUFFER_SIZE) % JOBLOG_BUFFER_SIZE;
+            log->length = JOBLOG_BUFFER_SIZE;
+        }
+        data += chunk;
+        length -= chunk;
+    }
+};
+
+// Reads everything a job has written so far into its log, in large reads (the pipe does not block)
+// Closes the pipe once every writer has closed it
+void readJobLog(struct jobLog *log)
+{
+    char chunk[JOBLOG_BUFFER_SIZE];
+    ssize_t nread;
+    while (log->fd != -1 && (nread = read(log->fd, chunk, sizeof(chunk))) != 0)
+    {
+        if (nread == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                return;
+            }
+            break;
+        }
+        if (timestampMode == 0)
+        {
+            appendLog(log, chunk, nread);
+            continue;
+        }
+
+        // Every line starting in this batch gets the time it was read
+        char stamp[32];
+        struct timespec now;
+        struct tm local;
+        clock_gettime(CLOCK_REALTIME, &now);
+        localtime_r(&now.tv_sec, &local);
+        size_t stampLength = strftime(stamp, sizeof(stamp), "[%H:%M:%S", &local);
+        stampLength += sprintf(stamp + stampLength, ".%03ld] ", now.tv_nsec / 1000000);
+        char *p = chunk;
+        char *end = chunk + nread;
+        while (p < end)
+        {
+            if (log->lineStart != 0)
+            {
+                appendLog(log, stamp, stampLength);
+            }
+            char *newline = memchr(p, '\n', end - p);
+            char *lineEnd = newline != NULL ? newline + 1 : end;
+            appendLog(log, p, lineEnd - p);
+            log->lineStart = newline != NULL;
+            p = lineEnd;
+        }
+    }
+    if (log->fd != -1)
+    {
+        close(log->fd);
+        log->fd = -1;
+        activeLogs -= 1;
+    }
+};
+
+// Reads the output of every background job still being captured
+void drainJobLogs()
+{
+    struct jobLog *log;
+    for (log = jobLogs; log != NULL; log = log->next)
+    {
+        readJobLog(log);
+    }
+};
+
+// Fills fds with the pipes of the logs still being captured, returns how many there are
+int pollJobLogs(struct pollfd *fds)
+{
+    int count = 0;
+    struct jobLog *log;
+    for (log = jobLogs; log != NULL; log = log->next)
+    {
+        if (log->fd != -1)
+        {
+            fds[count].fd = log->fd;
+            fds[count].events = POLLIN;
+            count++;
+        }
+    }
+    return count;
+};
+
+// Sleeps until a child changes state or a captured job writes output, reading that output
+void waitForOutput()
+{
+    struct pollfd *fds = malloc((activeLogs + 1) * sizeof(struct pollfd));
+    fds[0].fd = reapPipe[0];
+    fds[0].events = POLLIN;
+    int count = 1 + pollJobLogs(fds + 1);
+    poll(fds, count, -1);
+    free(fds);
+
+    // Leaves childExited set, so the prompt loop still reaps background jobs
+    char drain[64];
+    while (read(reapPipe[0], drain, sizeof(drain)) > 0)
+    {
+    }
+    drainJobLogs();
+};
+
+// Starts capturing a background job's output from the read end of its pipe
+// The log replaces the one of an earlier job with the same number
+struct jobLog *createJobLog(int number, char *commandLine, int fd)
+{
+    struct jobLog **link;
+    for (link = &jobLogs; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->number == number)
+        {
+            struct jobLog *oldLog = *link;
+            if (oldLog->fd != -1)
+            {
+                close(oldLog->fd);
+                activeLogs -= 1;
+            }
+            *link = oldLog->next;
+            free(oldLog->commandLine);
+            free(oldLog->buffer);
+            free(oldLog);
+            break;
+        }
+    }
+    struct jobLog *newLog = malloc(sizeof(struct jobLog));
+    newLog->number = number;
+    newLog->commandLine = strdup(commandLine);
+    newLog->fd = fd;
+    newLog->buffer = malloc(JOBLOG_BUFFER_SIZE);
+    newLog->start = 0;
+    newLog->length = 0;
+    newLog->dropped = 0;
+    newLog->lineStart = 1;
+    newLog->next = jobLogs;
+    jobLogs = newLog;
+    activeLogs += 1;
+    return newLog;
+};
+
+// Reads the rest of a finished job's output and stops capturing it (writers left behind are ignored)
+void closeJobLog(struct jobLog *log)
+{
+    readJobLog(log);
+    if (log->fd != -1)
+    {
+        close(log->fd);
+        log->fd = -1;
+        activeLogs -= 1;
+    }
+};
+
+// Job created for every launched pipeline, tracked until all of its stages have terminated
+struct job
+{
+    int number;  // Job number used in %n job specs
+    pid_t pgid;  // Process group shared by all stages with job control, else only the first stage's PID
+    int stageCount;
+    pid_t *pids;  // PID of each stage (0 if the stage could not be started)
+    int *statuses;  // Wait status of each stage (exit value 1 for stages that could not be started)
+    char *reaped;  // Whether each stage has terminated (or was never started)
+    int running;  // Number of stages not yet terminated
+    int stopped;  // Whether the job is stopped
+    char *commandLine;  // Command text shown by jobs, fg and bg
+    struct termios modes;  // Terminal modes saved when the job was stopped
+    int timed;  // Whether timing is reported when the job finishes
+    char *statsName;  // Name latencies are recorded under in stats mode (NULL if not recorded)
+    struct timespec started;  // When the job was launched
+    struct rusage usage;  // CPU time of terminated stages added up, their largest maximum RSS
+    char *cgroup;  // cgroup v2 leaf the job runs in (NULL if none), removed when the job is freed
+    struct jobLog *log;  // Output captured from the job in joblog mode (NULL if it is not captured)
+};
+
+struct job **jobTable = NULL;  // Compact table of background and stopped jobs
+int jobCount = 0;  // Number of entries in jobTable
+int jobCapacity = 0;  // Allocated entries in jobTable
+struct job *foregroundJob = NULL;  // Job currently running in the foreground (not in jobTable)
+int lastBackgroundStatus = 0;  // Status of the most recently completed background job
+int messageNewline = 0;  // Set while the prompt is displayed, so the next job message starts on a new line
+
+// Creates a job for a launched pipeline
+struct job *createJob(pid_t pgid, pid_t *pids, int stageCount, char *commandLine)
+{
+    int i;
+    struct job *newJob = malloc(sizeof(struct job));
+    newJob->number = 0;
+    newJob->pgid = pgid;
+    newJob->stageCount = stageCount;
+    newJob->pids = malloc(stageCount * sizeof(pid_t));
+    newJob->statuses = malloc(stageCount * sizeof(int));
+    newJob->reaped = malloc(stageCount);
+    newJob->running = 0;
+    newJob->stopped = 0;
+    newJob->commandLine = strdup(commandLine);
+    newJob->timed = 0;
+    newJob->statsName = NULL;
+    newJob->cgroup = NULL;
+    newJob->log = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &newJob->started);
+    memset(&newJob->usage, 0, sizeof(struct rusage));
+    for (i = 0; i < stageCount; i++)
+    {
+        newJob->pids[i] = pids[i] == -1 ? 0 : pids[i];
+        newJob->statuses[i] = W_EXITCODE(1, 0);
+        newJob->reaped[i] = pids[i] == -1;
+        if (pids[i] != -1)
+        {
+            newJob->running += 1;
+        }
+    }
+    return newJob;
+};
+
+// Sends a signal to every process of a job: its process group with job control, else each stage
+// still running (the stages then share smallsh's own group)
+int signalJob(struct job *currJob, int signo)
+{
+    int i;
+    int result = -1;
+    if (jobControl != 0)
+    {
+        return kill(-currJob->pgid, signo);
+    }
+    for (i = 0; i < currJob->stageCount; i++)
+    {
+        if (currJob->reaped[i] == 0 && kill(currJob->pids[i], signo) == 0)
+        {
+            result = 0;
+        }
+    }
+    return result;
+};
+
+// Frees a job that is no longer tracked
+void freeJob(struct job *oldJob)
+{
+    free(oldJob->pids);
+    free(oldJob->statuses);
+    free(oldJob->reaped);
+    free(oldJob->commandLine);
+    free(oldJob->statsName);
+    if (oldJob->cgroup != NULL)
+    {
+        rmdir(oldJob->cgroup);
+        free(oldJob->cgroup);
+    }
+    free(oldJob);
+};
+
+// Returns a job's status: its last stage's, or with pipefail its last failing stage's
+int jobStatus(struct job *currJob)
+{
+    int i;
+    int status = currJob->statuses[currJob->stageCount - 1];
+    for (i = 0; i < currJob->stageCount; i++)
+    {
+        if (pipefailMode != 0 && currJob->statuses[i] != 0)
+        {
+            status = currJob->statuses[i];
+        }
+    }
+    return status;
+};
+
+// Returns the PID that identifies a job in messages (its last stage that was started)
+pid_t jobPid(struct job *currJob)
+{
+    int i = currJob->stageCount - 1;
+    while (i > 0 && currJob->pids[i] == 0)
+    {
+        i -= 1;
+    }
+    return currJob->pids[i];
+};
+
+// Adds a job to the end of the job table, numbering it after the highest job number in use
+void addJob(struct job *newJob)
+{
+    int i;
+    if (jobCount == jobCapacity)
+    {
+        jobCapacity = jobCapacity == 0 ? 16 : jobCapacity * 2;
+        jobTable = realloc(jobTable, jobCapacity * sizeof(struct job *));
+    }
+    newJob->number = 1;
+    for (i = 0; i < jobCount; i++)
+    {
+        if (jobTable[i]->number >= newJob->number)
+        {
+            newJob->number = jobTable[i]->number + 1;
+        }
+    }
+    jobTable[jobCount] = newJob;
+    jobCount += 1;
+};
+
+// Removes a job table entry by moving the last entry into its place
+void removeJob(int index)
+{
+    jobCount -= 1;
+    jobTable[index] = jobTable[jobCount];
+};
+
+// Returns the job containing a PID (the foreground job or a table entry) and stores the stage index
+struct job *findJobByPid(pid_t pid, int *stage, int *index)
+{
+    int i;
+    int j;
+    *index = -1;
+    if (foregroundJob != NULL)
+    {
+        for (j = 0; j < foregroundJob->stageCount; j++)
+        {
+            if (foregroundJob->pids[j] == pid && foregroundJob->reaped[j] == 0)
+            {
+                *stage = j;
+                return foregroundJob;
+            }
+        }
+    }
+    for (i = 0; i < jobCount; i++)
+    {
+        for (j = 0; j < jobTable[i]->stageCount; j++)
+        {
+            if (jobTable[i]->pids[j] == pid && jobTable[i]->reaped[j] == 0)
+            {
+                *stage = j;
+                *index = i;
+                return jobTable[i];
+            }
+        }
+    }
+    return NULL;
+};
+
+// Parses a job spec (%n, %%, %+, or a PID) and returns the table index, or -1 with a message
+// A NULL spec selects the most recent job
+int findJobBySpec(char *builtin, char *spec)
+{
+    int i;
+    int best = -1;
+    for (i = 0; i < jobCount; i++)
+    {
+        int matches;
+        if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+        {
+            matches = best == -1 || jobTable[i]->number > jobTable[best]->number;
+        }
+        else if (spec[0] == '%')
+        {
+            matches = jobTable[i]->number == atoi(spec + 1);
+        }
+        else
+        {
+            matches = jobTable[i]->pgid == atoi(spec) || jobPid(jobTable[i]) == atoi(spec);
+        }
+        if (matches)
+        {
+            best = i;
+        }
+    }
+    if (best == -1)
+    {
+        printf("%s: %s: no such job\n", builtin, spec != NULL ? spec : "current");
+        fflush(stdout);
+    }
+    return best;
+};
+
+// Latency histogram of the jobs run under one name, with buckets spaced like an HDR histogram:
+// exact below HISTOGRAM_SUB_BUCKETS microseconds, then HISTOGRAM_SUB_BUCKETS per power of two
+struct latencyStats
+{
+    char *name;
+    long count;
+    long long min;  // Microseconds
+    long long max;
+    unsigned int buckets[HISTOGRAM_BUCKETS];
+    struct latencyStats *next;
+};
+
+struct latencyStats *statsTable[STATS_TABLE_SIZE];  // Hash table of histograms by command name
+
+// Returns the histogram bucket of a latency in microseconds
+int histogramBucket(long long micros)
+{
+    if (micros < HISTOGRAM_SUB_BUCKETS)
+    {
+        return micros < 0 ? 0 : micros;
+    }
+    int magnitude = 63 - __builtin_clzll(micros);  // Position of the highest set bit, at least 4
+    int sub = (micros >> (magnitude - 4)) - HISTOGRAM_SUB_BUCKETS;
+    return (magnitude - 3) * HISTOGRAM_SUB_BUCKETS + sub;
+};
+
+// Returns the largest latency in microseconds that falls in a histogram bucket
+long long histogramValue(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    int magnitude = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+    long long lowest = (long long)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << (magnitude - 4);
+    return lowest + (1LL << (magnitude - 4)) - 1;
+};
+
+// Adds a job latency to the histogram kept for its name
+void recordLatency(char *name, long long micros)
+{
+    unsigned int bucket = hashString(name, strlen(name)) % STATS_TABLE_SIZE;
+    struct latencyStats *stats;
+    for (stats = statsTable[bucket]; stats != NULL && strcmp(stats->name, name) != 0; stats = stats->next)
+    {
+    }
+    if (stats == NULL)
+    {
+        stats = calloc(1, sizeof(struct latencyStats));
+        stats->name = strdup(name);
+        stats->min = micros;
+        stats->next = statsTable[bucket];
+        statsTable[bucket] = stats;
+    }
+    stats->count += 1;
+    stats->min = micros < stats->min ? micros : stats->min;
+    stats->max = micros > stats->max ? micros : stats->max;
+    stats->buckets[histogramBucket(micros)] += 1;
+};
+
+// Returns the latency in microseconds at a percentile of a histogram (clamped to the recorded maximum)
+long long latencyPercentile(struct latencyStats *stats, double percentile)
+{
+    long target = (long)(stats->count * percentile / 100.0 + 0.999999);
+    long seen = 0;
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += stats->buckets[i];
+        if (seen >= target && seen > 0)
+        {
+            long long value = histogramValue(i);
+            return value > stats->max ? stats->max : value;
+        }
+    }
+    return stats->max;
+};
+
+// Displays every latency histogram as a row of milliseconds
+void printLatencyStats()
+{
+    int i;
+    struct latencyStats *stats;
+    printf("%-24s %8s %10s %10s %10s %10s %10s\n", "command", "count", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (i = 0; i < STATS_TABLE_SIZE; i++)
+    {
+        for (stats = statsTable[i]; stats != NULL; stats = stats->next)
+        {
+            printf("%-24s %8ld %10.3f %10.3f %10.3f %10.3f %10.3f\n", stats->name, stats->count,
+                stats->min / 1000.0, latencyPercentile(stats, 50) / 1000.0, latencyPercentile(stats, 90) / 1000.0,
+                latencyPercentile(stats, 99) / 1000.0, stats->max / 1000.0);
+        }
+    }
+    fflush(stdout);
+};
+
+// Forgets all latency histograms
+void clearLatencyStats()
+{
+    int i;
+    for (i = 0; i < STATS_TABLE_SIZE; i++)
+    {
+        while (statsTable[i] != NULL)
+        {
+            struct latencyStats *stats = statsTable[i];
+            statsTable[i] = stats->next;
+            free(stats->name);
+            free(stats);
+        }
+    }
+};
+
+// Adds the CPU time of a terminated stage to a job's usage and keeps the largest maximum RSS
+void addUsage(struct rusage *total, struct rusage *usage)
+{
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss)
+    {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+};
+
+// Reports a job's timing if it was run with time and records its latency in stats mode
+// Called once the last stage of the job has terminated
+void finishJob(struct job *doneJob)
+{
+    if (doneJob->timed == 0 && doneJob->statsName == NULL)
+    {
+        return;
+    }
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long long micros = (finished.tv_sec - doneJob->started.tv_sec) * 1000000LL +
+        (finished.tv_nsec - doneJob->started.tv_nsec) / 1000;
+
+    // Prints times like other shells do, on stderr so the command's output can be redirected apart
+    if (doneJob->timed != 0)
+    {
+        struct rusage *usage = &doneJob->usage;
+        fprintf(stderr, "\nreal\t%lldm%.3fs\n", micros / 60000000, (micros % 60000000) / 1e6);
+        fprintf(stderr, "user\t%ldm%.3fs\n", (long)usage->ru_utime.tv_sec / 60,
+            usage->ru_utime.tv_sec % 60 + usage->ru_utime.tv_usec / 1e6);
+        fprintf(stderr, "sys\t%ldm%.3fs\n", (long)usage->ru_stime.tv_sec / 60,
+            usage->ru_stime.tv_sec % 60 + usage->ru_stime.tv_usec / 1e6);
+        fprintf(stderr, "maxrss\t%ldk\n", usage->ru_maxrss);
+    }
+    if (doneJob->statsName != NULL)
+    {
+        recordLatency(doneJob->statsName, micros);
+    }
+};
+
+// Writes a value to a file of a cgroup, returns -1 if it cannot be written
+int writeCgroupFile(const char *cgroup, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t written = write(fd, value, strlen(value));
+    close(fd);
+    return written == (ssize_t)strlen(value) ? 0 : -1;
+};
+
+// Reads the number in a file of a cgroup, returns -1 if it cannot be read
+long long readCgroupValue(const char *cgroup, const char *file)
+{
+    char path[PATH_MAX];
+    char value[32];
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t nread = read(fd, value, sizeof(value) - 1);
+    close(fd);
+    if (nread <= 0 || !isdigit((unsigned char)value[0]))
+    {
+        return -1;
+    }
+    value[nread] = '\0';
+    return atoll(value);
+};
+
+// Creates a cgroup v2 leaf for a job under the SMALLSH_CGROUP directory, with its memory.max and cpu.max
+// Returns its path, or NULL if the job has no cgroup limits or the cgroup is not writable
+char *createJobCgroup(struct jobLimits *limits)
+{
+    char *base = getVariable("SMALLSH_CGROUP");
+    if (base == NULL || base[0] == '\0' || (limits->memoryMax == 0 && limits->cpuPercent == 0))
+    {
+        return NULL;
+    }
+    char path[PATH_MAX];
+    char value[32];
+    cgroupSequence += 1;
+    snprintf(path, sizeof(path), "%s/smallsh-%s-%d", base, shellPidString, cgroupSequence);
+    if (mkdir(path, 0755) == -1)
+    {
+        return NULL;
+    }
+
+    // cpu.max is a quota per 100ms period
+    int failed = 0;
+    if (limits->memoryMax != 0)
+    {
+        sprintf(value, "%lld", limits->memoryMax);
+        failed |= writeCgroupFile(path, "memory.max", value);
+    }
+    if (limits->cpuPercent != 0)
+    {
+        sprintf(value, "%d 100000", limits->cpuPercent * 1000);
+        failed |= writeCgroupFile(path, "cpu.max", value);
+    }
+    if (failed != 0)
+    {
+        rmdir(path);
+        return NULL;
+    }
+    return strdup(path);
+};
+
+// Displays the completion message for a background job, with the resources it used
+void reportJob(struct job *doneJob)
+{
+    int backgroundStatus = jobStatus(doneJob);
+
+    // Adds the job's CPU time and peak memory, from its cgroup when it has one
+    char usageText[64];
+    long long peakMemory = doneJob->cgroup != NULL ? readCgroupValue(doneJob->cgroup, "memory.peak") : -1;
+    struct timeval cpuTime;
+    timeradd(&doneJob->usage.ru_utime, &doneJob->usage.ru_stime, &cpuTime);
+    snprintf(usageText, sizeof(usageText), "(cpu %.3fs, max memory %lldk)", cpuTime.tv_sec + cpuTime.tv_usec / 1e6,
+        peakMemory != -1 ? peakMemory / 1024 : (long long)doneJob->usage.ru_maxrss);
+    if (messageNewline != 0)
+    {
+        printf("\n");
+        messageNewline = 0;
+    }
+    if (WIFEXITED(backgroundStatus))
+    {
+        printf("background pid %d is done: exit value %d %s\n", jobPid(doneJob), WEXITSTATUS(backgroundStatus),
+            usageText);
+    }
+    else
+    {
+        printf("background pid %d is done: terminated by signal %d %s\n", jobPid(doneJob), WTERMSIG(backgroundStatus),
+            usageText);
+    }
+    fflush(stdout);
+};
+
+// Records a wait status and resource usage reported for a child of the foreground job or of a table job
+// Background jobs are reported and removed once their last stage terminates
+void updateJob(pid_t pid, int waitStatus, struct rusage *usage)
+{
+    int stage;
+    int index;
+    struct job *currJob = findJobByPid(pid, &stage, &index);
+    if (currJob == NULL)
+    {
+        return;
+    }
+    if (traceFd != -1)
+    {
+        traceBegin("reap", pid, traceNow(), -1);
+        traceFormat("\"pid\":%d,\"background\":%s,", (int)pid, index != -1 ? "true" : "false");
+        traceStatus(waitStatus);
+        traceEnd();
+    }
+
+    // Stopped or continued stages change the whole job's state
+    if (WIFSTOPPED(waitStatus))
+    {
+        if (index != -1 && currJob->stopped == 0)
+        {
+            if (messageNewline != 0)
+            {
+                printf("\n");
+                messageNewline = 0;
+            }
+            printf("[%d]  Stopped\t\t%s\n", currJob->number, currJob->commandLine);
+            fflush(stdout);
+        }
+        currJob->stopped = 1;
+        return;
+    }
+    if (WIFCONTINUED(waitStatus))
+    {
+        currJob->stopped = 0;
+        return;
+    }
+
+    // Else, the stage terminated
+    currJob->statuses[stage] = waitStatus;
+    currJob->reaped[stage] = 1;
+    currJob->running -= 1;
+    addUsage(&currJob->usage, usage);
+    if (index != -1 && currJob->running == 0)
+    {
+        if (currJob->log != NULL)
+        {
+            closeJobLog(currJob->log);
+        }
+        lastBackgroundStatus = jobStatus(currJob);
+        reportJob(currJob);
+        finishJob(currJob);
+        removeJob(index);
+        freeJob(currJob);
+    }
+};
+
+// Reaps every finished background process and displays completion messages
+// atPrompt is set when the prompt is already displayed, so messages start on a new line
+void reapJobs(int atPrompt)
+{
+    int backgroundStatus;
+    struct rusage usage;
+    pid_t donePid;
+
+    // Clears the notification before reaping, so exits that race with the loop are not missed
+    childExited = 0;
+    char drain[64];
+    while (read(reapPipe[0], drain, sizeof(drain)) > 0)
+    {
+    }
+
+    messageNewline = atPrompt;
+    while ((donePid = wait4(-1, &backgroundStatus, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+    {
+        updateJob(donePid, backgroundStatus, &usage);
+    }
+
+    // Redisplays the prompt if messages were printed over it
+    if (atPrompt != 0 && messageNewline == 0)
+    {
+        printf(": ");
+        fflush(stdout);
+    }
+    messageNewline = 0;
+};
+
+// Waits for a job in the foreground, handing it the terminal when job control is on
+// Returns 1 when the job has terminated (its status is stored in childStatus), 0 if it stopped
+int waitForeground(struct job *currJob)
+{
+    foregroundJob = currJob;
+    foregroundHelper = currJob->pgid;
+    if (jobControl != 0 && currJob->running > 0)
+    {
+        tcsetpgrp(STDIN_FILENO, currJob->pgid);
+    }
+
+    // Waits for any child, so background processes finishing meanwhile are reaped right away
+    double start = traceFd != -1 ? traceNow() : 0;
+    while (currJob->running > 0 && currJob->stopped == 0)
+    {
+        // While background output is captured, it is read as it arrives so those jobs never block on a full pipe
+        int waitStatus;
+        struct rusage usage;
+        int options = jobControl != 0 ? WUNTRACED : 0;
+        if (activeLogs != 0)
+        {
+            options |= WNOHANG;
+        }
+        pid_t donePid = wait4(-1, &waitStatus, options, &usage);
+        if (donePid == 0)
+        {
+            waitForOutput();
+            continue;
+        }
+        if (donePid == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        updateJob(donePid, waitStatus, &usage);
+    }
+
+    // Takes the terminal back, restoring the shell's terminal modes
+    if (jobControl != 0 && currJob->pgid != 0)
+    {
+        tcsetpgrp(STDIN_FILENO, shellPgid);
+        tcgetattr(STDIN_FILENO, &currJob->modes);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shellModes);
+    }
+    foregroundJob = NULL;
+    foregroundHelper = 0;
+    if (traceFd != -1)
+    {
+        traceBegin("wait", getpid(), start, traceNow() - start);
+        traceFormat("\"pgid\":%d,\"command\":", (int)currJob->pgid);
+        traceString(currJob->commandLine);
+        traceFormat(",");
+        traceStatus(currJob->stopped != 0 ? W_STOPCODE(SIGTSTP) : jobStatus(currJob));
+        traceEnd();
+    }
+
+    // A stopped job moves to the job table
+    if (currJob->stopped != 0)
+    {
+        addJob(currJob);
+        printf("\n[%d]  Stopped\t\t%s\n", currJob->number, currJob->commandLine);
+        fflush(stdout);
+        return 0;
+    }
+    childStatus = jobStatus(currJob);
+    finishJob(currJob);
+    freeJob(currJob);
+    return 1;
+};
+
+// Takes control of the terminal so jobs can be moved between the foreground and background
+void initJobControl()
+{
+    // Waits until smallsh itself is in the foreground
+    while (tcgetpgrp(STDIN_FILENO) != getpgrp())
+    {
+        kill(-getpgrp(), SIGTTIN);
+    }
+
+    // Ignores the signals sent to a background process group touching the terminal
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Puts smallsh in its own process group (already true for session leaders) and takes the terminal
+    setpgid(0, 0);
+    shellPgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shellPgid);
+    tcgetattr(STDIN_FILENO, &shellModes);
+    jobControl = 1;
+};
+
+// Parses a signal given as a number or a name with or without the SIG prefix, returns -1 if unknown
+int parseSignal(char *name)
+{
+    char *names[] = {"HUP", "INT", "QUIT", "KILL", "USR1", "USR2", "PIPE", "ALRM", "TERM", "CHLD", "CONT", "STOP", "TSTP", "TTIN", "TTOU"};
+    int numbers[] = {SIGHUP, SIGINT, SIGQUIT, SIGKILL, SIGUSR1, SIGUSR2, SIGPIPE, SIGALRM, SIGTERM, SIGCHLD, SIGCONT, SIGSTOP, SIGTSTP, SIGTTIN, SIGTTOU};
+    int i;
+    if (isdigit((unsigned char)name[0]))
+    {
+        return atoi(name);
+    }
+    if (strncmp(name, "SIG", 3) == 0)
+    {
+        name += 3;
+    }
+    for (i = 0; i < (int)(sizeof(numbers) / sizeof(int)); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            return numbers[i];
+        }
+    }
+    return -1;
+};
+
+// Waits until fd has input, reaping background processes as soon as they finish
+// Output of background jobs captured in joblog mode is read meanwhile
+void waitForInput(int fd)
+{
+    while (1)
+    {
+        struct pollfd *fds = malloc((activeLogs + 2) * sizeof(struct pollfd));
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = reapPipe[0];
+        fds[1].events = POLLIN;
+        int count = 2 + pollJobLogs(fds + 2);
+        int result = poll(fds, count, -1);
+        int ready = fds[0].revents != 0;
+        free(fds);
+        if (result == -1 && errno != EINTR)
+        {
+            return;
+        }
+        if (count > 2)
+        {
+            drainJobLogs();
+        }
+        if (childExited != 0)
+        {
+            reapJobs(interactiveMode);
+        }
+        if (ready != 0)
+        {
+            return;
+        }
+    }
+};
+
+// Source of command lines: a mapped script file, a -c string, or a descriptor read in large chunks
+struct inputSource
+{
+    char *data;  // Buffered input
+    size_t length;  // Number of valid bytes in data
+    size_t capacity;  // Allocated size of data (0 if data is mapped or borrowed)
+    size_t pos;  // Start of the next unread line
+    int fd;  // Descriptor refilled from (-1 once everything is in data)
+    int mapped;  // Whether data is a mapping of the whole file
+    size_t released;  // Bytes at the start of a mapped file already dropped from memory
+};
+
+// Opens a file as an input source, mapping it whole when possible, returns -1 if it cannot be opened
+int openScript(struct inputSource *input, char *path)
+{
+    struct stat fileInfo;
+    memset(input, 0, sizeof(struct inputSource));
+    input->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (input->fd == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    input->fd = moveDescriptor(input->fd);
+
+    // Regular files are mapped and read without any further system calls
+    if (fstat(input->fd, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) && fileInfo.st_size > 0)
+    {
+        void *mapped = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            madvise(mapped, fileInfo.st_size, MADV_SEQUENTIAL);
+            input->data = mapped;
+            input->length = fileInfo.st_size;
+            input->mapped = 1;
+            close(input->fd);
+            input->fd = -1;
+        }
+    }
+    return 0;
+};
+
+// Returns the next line (including its newline, not NUL-terminated) and stores its length
+// Returns NULL at end of input
+char *readLine(struct inputSource *input, size_t *lineLength)
+{
+    while (1)
+    {
+        // Returns the next complete line already in the buffer
+        char *start = input->data + input->pos;
+        size_t available = input->length - input->pos;
+        char *newline = available > 0 ? memchr(start, '\n', available) : NULL;
+        if (newline != NULL)
+        {
+            *lineLength = newline - start + 1;
+            input->pos += *lineLength;
+
+            // Drops pages of a mapped file that were already read, so long scripts use constant memory
+            size_t consumed = (start - input->data) & ~(size_t)(MAPPED_RELEASE_SIZE - 1);
+            if (input->mapped != 0 && consumed > input->released)
+            {
+                madvise(input->data + input->released, consumed - input->released, MADV_DONTNEED);
+                input->released = consumed;
+            }
+            return start;
+        }
+
+        // Returns a final line without a newline once nothing more can be read
+        if (input->fd == -1)
+        {
+            if (available == 0)
+            {
+                return NULL;
+            }
+            *lineLength = available;
+            input->pos = input->length;
+            return start;
+        }
+
+        // Moves the partial line to the front of the buffer, growing it if the line fills it
+        memmove(input->data, start, available);
+        input->length = available;
+        input->pos = 0;
+        if (input->capacity - input->length < INPUT_CHUNK_SIZE)
+        {
+            input->capacity = input->length + INPUT_CHUNK_SIZE;
+            input->data = realloc(input->data, input->capacity);
+        }
+
+        // Refills the buffer with as much as is ready (a terminal returns one line at a time)
+        waitForInput(input->fd);
+        ssize_t nread = read(input->fd, input->data + input->length, input->capacity - input->length);
+        if (nread <= 0)
+        {
+            input->fd = -1;
+        }
+        else
+        {
+            input->length += nread;
+        }
+    }
+};
+
+void readHereDocuments(char *line, const char *origin, struct inputSource *input);
+
+// Reads the here-documents used inside the command substitutions of the word tok, in order
+void readSubstitutionDocuments(char *line, const char *origin, struct token *tok, struct inputSource *input)
+{
+    int doubleQuoted = 0;
+    size_t i;
+    for (i = tok->start; i < tok->start + tok->length; i++)
+    {
+        if (line[i] == '\\')
+        {
+            i++;
+        }
+        else if (line[i] == '\'' && doubleQuoted == 0)
+        {
+            while (i + 1 < tok->start + tok->length && line[i + 1] != '\'')
+            {
+                i++;
+            }
+            i++;
+        }
+        else if (line[i] == '"')
+        {
+            doubleQuoted = !doubleQuoted;
+        }
+        else if (line[i] == '`' || (line[i] == '$' && line[i + 1] == '('))
+        {
+            const char *close = skipSubstitution(line + i);
+            if (close == NULL)
+            {
+                return;
+            }
+            size_t start = i + (line[i] == '`' ? 1 : 2);
+            char *text = arenaStrndup(&lineArena, line + start, close - line - start - 1);
+            readHereDocuments(text, origin + start, input);
+            i = close - line - 1;
+        }
+    }
+};
+
+// Reads the bodies of the here-documents a command line uses from the lines of input after it
+// Bodies are kept in the line arena until the line is parsed, so nothing touches the filesystem
+// line is the command line or the text of a substitution in it, which starts at origin in the command line
+void readHereDocuments(char *line, const char *origin, struct inputSource *input)
+{
+    struct hereDocument **link = &hereDocuments;
+    struct token tok;
+    size_t pos = 0;
+    while (*link != NULL)
+    {
+        link = &(*link)->next;
+    }
+    while (nextToken(line, &pos, &tok) != TOKEN_END && tok.type != TOKEN_ERROR)
+    {
+        if (tok.type == TOKEN_WORD && tok.expand != 0)
+        {
+            readSubstitutionDocuments(line, origin, &tok, input);
+            while (*link != NULL)
+            {
+                link = &(*link)->next;
+            }
+            continue;
+        }
+        int strip = tok.type == TOKEN_HEREDOC_STRIP;
+        if ((tok.type != TOKEN_HEREDOC && strip == 0) || nextToken(line, &pos, &tok) != TOKEN_WORD)
+        {
+            continue;
+        }
+
+        // The delimiter is the word with its quotes removed, quoting any part of it turns expansion off
+        struct hereDocument *document = arenaAlloc(&lineArena, sizeof(struct hereDocument));
+        char *delimiter = arenaAlloc(&lineArena, tok.length + 1);
+        size_t delimiterLength = 0;
+        char quote = '\0';
+        size_t i;
+        for (i = tok.start; i < tok.start + tok.length; i++)
+        {
+            if (quote == '\0' && (line[i] == '\'' || line[i] == '"'))
+            {
+                quote = line[i];
+            }
+            else if (quote != '\0' && line[i] == quote)
+            {
+                quote = '\0';
+            }
+            else
+            {
+                if (line[i] == '\\' && quote != '\'' && i + 1 < tok.start + tok.length)
+                {
+                    i++;
+                }
+                delimiter[delimiterLength++] = line[i];
+            }
+        }
+        delimiter[delimiterLength] = '\0';
+        document->delimiter = origin + tok.start;
+        document->expand = tok.quoted == 0;
+        document->next = NULL;
+
+        // Collects lines up to the delimiter line (<<- removes leading tabs from both)
+        struct wordBuffer body = {"", 0, 0};
+        while (1)
+        {
+            if (interactiveMode != 0)
+            {
+                printf("> ");
+                fflush(stdout);
+            }
+            size_t length;
+            char *bodyLine = readLine(input, &length);
+            if (bodyLine == NULL)
+            {
+                printf("here-document delimited by end of file (wanted `%s')\n", delimiter);
+                fflush(stdout);
+                break;
+            }
+            while (strip != 0 && length > 0 && bodyLine[0] == '\t')
+            {
+                bodyLine++;
+                length--;
+            }
+            size_t textLength = length > 0 && bodyLine[length - 1] == '\n' ? length - 1 : length;
+            if (textLength == delimiterLength && memcmp(bodyLine, delimiter, delimiterLength) == 0)
+            {
+                break;
+            }
+            appendExpansion(&body, bodyLine, textLength, 2);
+            body.data[body.length++] = '\n';
+        }
+        appendExpansion(&body, "", 0, 1);
+        body.data[body.length] = '\0';
+        document->body = body.data;
+        *link = document;
+        link = &document->next;
+    }
+};
+
+// Line of history, in the mapped history file or in memory for lines added this session
+struct historyEntry
+{
+    const char *text;  // Not NUL-terminated for lines in the mapped file
+    size_t length;
+};
+
+int historyFd = -1;  // History file, opened for appending (-1 when history is off)
+char *historyMap = NULL;  // Mapping of the history file as it was at startup (NULL if it was empty)
+size_t historyMapLength = 0;
+struct historyEntry *historyEntries = NULL;  // Lines of the mapped file, indexed on first use
+size_t historyFileCount = 0;  // Number of lines in the mapped file (valid once indexed)
+int historyIndexed = 0;  // Whether the mapped file has been split into historyEntries
+struct historyEntry *sessionHistory = NULL;  // Lines added this session, after the mapped ones
+size_t sessionCount = 0;
+size_t sessionCapacity = 0;
+size_t *historySorted = NULL;  // Indexes of the mapped lines sorted by text, built for the first prefix search
+size_t *historyRecent = NULL;  // Segment tree of the most recent line in ranges of historySorted
+unsigned int *gramStart = NULL;  // Start of each trigram bucket in gramLines, built for the first substring search
+unsigned int *gramLines = NULL;  // Mapped lines with a trigram in each bucket, oldest first
+
+// Opens the history file (SMALLSH_HISTFILE, or ~/.smallsh_history) and maps it
+// Nothing is parsed here so startup stays fast however long the history gets
+void initHistory()
+{
+    char *path = getVariable("SMALLSH_HISTFILE");
+    char defaultPath[PATH_MAX];
+    if (path == NULL)
+    {
+        char *homeDir = getVariable("HOME");
+        if (homeDir == NULL)
+        {
+            return;
+        }
+        snprintf(defaultPath, sizeof(defaultPath), "%s/%s", homeDir, HISTORY_FILE_NAME);
+        path = defaultPath;
+    }
+    if (path[0] == '\0')
+    {
+        return;
+    }
+    historyFd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (historyFd == -1)
+    {
+        return;
+    }
+    historyFd = moveDescriptor(historyFd);
+
+    struct stat info;
+    if (fstat(historyFd, &info) == 0 && info.st_size > 0)
+    {
+        historyMap = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, historyFd, 0);
+        if (historyMap == MAP_FAILED)
+        {
+            historyMap = NULL;
+            return;
+        }
+        historyMapLength = info.st_size;
+
+        // Ends a line cut short by a shell that died mid-write, so the next line starts afresh
+        if (historyMap[historyMapLength - 1] != '\n')
+        {
+            if (writeAll(historyFd, "\n", 1) == -1)
+            {
+                perror("history");
+            }
+        }
+    }
+};
+
+// Splits the mapped history file into lines, the first time a line is looked up by number
+void indexHistory()
+{
+    if (historyIndexed != 0)
+    {
+        return;
+    }
+    historyIndexed = 1;
+    const char *p = historyMap;
+    const char *end = historyMap + historyMapLength;
+    while (p < end)
+    {
+        const char *newline = memchr(p, '\n', end - p);
+        p = newline != NULL ? newline + 1 : end;
+        historyFileCount += 1;
+    }
+    historyEntries = malloc((historyFileCount + 1) * sizeof(struct historyEntry));
+    size_t count = 0;
+    for (p = historyMap; p < end; count++)
+    {
+        const char *newline = memchr(p, '\n', end - p);
+        historyEntries[count].text = p;
+        historyEntries[count].length = (newline != NULL ? newline : end) - p;
+        p = newline != NULL ? newline + 1 : end;
+    }
+};
+
+// Returns the number of lines in the history
+size_t historyCount()
+{
+    indexHistory();
+    return historyFileCount + sessionCount;
+};
+
+// Returns history line number n (numbered from 1, oldest first)
+struct historyEntry *historyLine(size_t n)
+{
+    indexHistory();
+    return n <= historyFileCount ? &historyEntries[n - 1] : &sessionHistory[n - historyFileCount - 1];
+};
+
+// Appends a line to the history file and to this session's lines
+void addHistory(const char *line, size_t length)
+{
+    if (historyFd == -1)
+    {
+        return;
+    }
+
+    // One write per line, so lines of shells sharing the file are not interleaved
+    char *record = malloc(length + 1);
+    memcpy(record, line, length);
+    record[length] = '\n';
+    if (writeAll(historyFd, record, length + 1) == -1)
+    {
+        perror("history");
+    }
+    if (sessionCount == sessionCapacity)
+    {
+        sessionCapacity = sessionCapacity == 0 ? 64 : sessionCapacity * 2;
+        sessionHistory = realloc(sessionHistory, sessionCapacity * sizeof(struct historyEntry));
+    }
+    sessionHistory[sessionCount].text = record;
+    sessionHistory[sessionCount].length = length;
+    sessionCount += 1;
+};
+
+// Orders mapped history lines by text, older lines first among equal ones, for qsort
+int compareHistory(const void *a, const void *b)
+{
+    struct historyEntry *x = &historyEntries[*(const size_t *)a];
+    struct historyEntry *y = &historyEntries[*(const size_t *)b];
+    int result = memcmp(x->text, y->text, x->length < y->length ? x->length : y->length);
+    if (result == 0)
+    {
+        result = (x->length > y->length) - (x->length < y->length);
+    }
+    if (result == 0)
+    {
+        result = (*(const size_t *)a > *(const size_t *)b) - (*(const size_t *)a < *(const size_t *)b);
+    }
+    return result;
+};
+
+// Sorts the mapped lines and builds the segment tree over them, the first time a prefix is searched
+// The mapped file never changes during a session, so this is only done once
+void buildHistorySearch()
+{
+    size_t i;
+    if (historySorted != NULL || historyCount() == sessionCount)
+    {
+        return;
+    }
+    historySorted = malloc(historyFileCount * sizeof(size_t));
+    for (i = 0; i < historyFileCount; i++)
+    {
+        historySorted[i] = i;
+    }
+    qsort(historySorted, historyFileCount, sizeof(size_t), compareHistory);
+
+    // Leaves hold the sorted lines, every other node the most recent line below it
+    historyRecent = malloc(2 * historyFileCount * sizeof(size_t));
+    memcpy(historyRecent + historyFileCount, historySorted, historyFileCount * sizeof(size_t));
+    for (i = historyFileCount - 1; i > 0; i--)
+    {
+        size_t left = historyRecent[2 * i];
+        size_t right = historyRecent[2 * i + 1];
+        historyRecent[i] = left > right ? left : right;
+    }
+};
+
+// Returns the first position in historySorted whose line is not below prefix, compared over its
+// first length bytes (after is 1 to skip the lines starting with prefix as well)
+size_t historyBound(const char *prefix, size_t length, int after)
+{
+    size_t low = 0;
+    size_t high = historyFileCount;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        struct historyEntry *entry = &historyEntries[historySorted[middle]];
+        int result = memcmp(entry->text, prefix, entry->length < length ? entry->length : length);
+        if (result == 0 && entry->length < length)
+        {
+            result = -1;
+        }
+        if (result < 0 || (result == 0 && after != 0))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+};
+
+// Returns the number of the most recent history line starting with prefix, 0 if there is none
+// Lines of this session are checked first, the mapped file is binary searched in O(log n)
+size_t findHistoryPrefix(const char *prefix, size_t length)
+{
+    size_t i;
+    for (i = sessionCount; i > 0; i--)
+    {
+        if (sessionHistory[i - 1].length >= length && memcmp(sessionHistory[i - 1].text, prefix, length) == 0)
+        {
+            return historyFileCount + i;
+        }
+    }
+    buildHistorySearch();
+    if (historySorted == NULL)
+    {
+        return 0;
+    }
+
+    // The matching lines are a contiguous range of historySorted, its most recent line comes from the tree
+    size_t low = historyBound(prefix, length, 0) + historyFileCount;
+    size_t high = historyBound(prefix, length, 1) + historyFileCount;
+    size_t found = 0;
+    int any = low < high;
+    while (low < high)
+    {
+        if (low & 1)
+        {
+            found = historyRecent[low] > found ? historyRecent[low] : found;
+            low++;
+        }
+        if (high & 1)
+        {
+            high--;
+            found = historyRecent[high] > found ? historyRecent[high] : found;
+        }
+        low /= 2;
+        high /= 2;
+    }
+    return any != 0 ? found + 1 : 0;
+};
+
+// Returns the bucket of the trigram index for the three bytes at p
+unsigned int gramBucket(const char *p)
+{
+    const unsigned char *bytes = (const unsigned char *)p;
+    return ((bytes[0] * 65599u + bytes[1]) * 65599u + bytes[2]) & (HISTORY_GRAM_BUCKETS - 1);
+};
+
+// Builds the trigram index of the mapped lines, the first time a substring is searched: each bucket
+// lists the lines holding a trigram that hashes to it, once per line. Counted in a first pass over
+// the lines and filled in a second, so it takes one array of line numbers
+void buildHistoryGrams()
+{
+    size_t line;
+    size_t i;
+    int pass;
+    if (gramStart != NULL || historyCount() == sessionCount)
+    {
+        return;
+    }
+    gramStart = calloc(HISTORY_GRAM_BUCKETS + 1, sizeof(unsigned int));
+    unsigned int *lastLine = malloc(HISTORY_GRAM_BUCKETS * sizeof(unsigned int));
+    unsigned int *fill = NULL;
+    for (pass = 0; pass < 2; pass++)
+    {
+        memset(lastLine, 0xff, HISTORY_GRAM_BUCKETS * sizeof(unsigned int));
+        for (line = 0; line < historyFileCount; line++)
+        {
+            struct historyEntry *entry = &historyEntries[line];
+            for (i = 0; i + 3 <= entry->length; i++)
+            {
+                unsigned int bucket = gramBucket(entry->text + i);
+                if (lastLine[bucket] == line)
+                {
+                    continue;
+                }
+                lastLine[bucket] = line;
+                if (pass == 0)
+                {
+                    gramStart[bucket + 1] += 1;
+                }
+                else
+                {
+                    gramLines[fill[bucket]++] = line;
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (i = 0; i < HISTORY_GRAM_BUCKETS; i++)
+            {
+                gramStart[i + 1] += gramStart[i];
+            }
+            gramLines = malloc((gramStart[HISTORY_GRAM_BUCKETS] + 1) * sizeof(unsigned int));
+            fill = malloc(HISTORY_GRAM_BUCKETS * sizeof(unsigned int));
+            memcpy(fill, gramStart, HISTORY_GRAM_BUCKETS * sizeof(unsigned int));
+        }
+    }
+    free(fill);
+    free(lastLine);
+};
+
+// Returns the number of the most recent history line containing str, 0 if there is none
+// Lines of this session are scanned first. In the mapped file only the lines listed under the
+// rarest trigram of str are checked, newest first (strings under three bytes scan every line)
+size_t findHistorySubstring(const char *str, size_t length)
+{
+    size_t n;
+    size_t i;
+    indexHistory();
+    for (n = sessionCount; n > 0; n--)
+    {
+        if (memmem(sessionHistory[n - 1].text, sessionHistory[n - 1].length, str, length) != NULL)
+        {
+            return historyFileCount + n;
+        }
+    }
+    if (length < 3)
+    {
+        for (n = historyFileCount; n > 0; n--)
+        {
+            if (memmem(historyEntries[n - 1].text, historyEntries[n - 1].length, str, length) != NULL)
+            {
+                return n;
+            }
+        }
+        return 0;
+    }
+    buildHistoryGrams();
+    if (gramStart == NULL)
+    {
+        return 0;
+    }
+
+    // Every line containing str is listed under each of its trigrams, so the shortest list is enough
+    unsigned int rarest = gramBucket(str);
+    for (i = 1; i + 3 <= length; i++)
+    {
+        unsigned int bucket = gramBucket(str + i);
+        if (gramStart[bucket + 1] - gramStart[bucket] < gramStart[rarest + 1] - gramStart[rarest])
+        {
+            rarest = bucket;
+        }
+    }
+    unsigned int k;
+    for (k = gramStart[rarest + 1]; k > gramStart[rarest]; k--)
+    {
+        struct historyEntry *entry = &historyEntries[gramLines[k - 1]];
+        if (memmem(entry->text, entry->length, str, length) != NULL)
+        {
+            return gramLines[k - 1] + 1;
+        }
+    }
+    return 0;
+};
+
+// Replaces history references in a line: !! (last line), !n, !-n, !prefix and !?string?
+// A ! is kept when it is quoted, escaped or followed by a blank, = or (
+// Returns the expanded line (in the line arena), or NULL after reporting a reference that was not found
+char *expandHistory(char *line)
+{
+    if (strchr(line, '!') == NULL)
+    {
+        return line;
+    }
+    struct wordBuffer result = {NULL, 0, 0};
+    const char *p = line;
+    int singleQuoted = 0;
+    int replaced = 0;
+    while (*p != '\0')
+    {
+        // Copies everything up to the next reference unchanged ($! is the parameter, and a ! before
+        // a closing double quote is literal)
+        const char *start = p;
+        while (*p != '\0' && (*p != '!' || singleQuoted != 0 || strchr(" \t\n=(\"", p[1]) != NULL ||
+        (p > line && p[-1] == '$')))
+        {
+            if (*p == '\'')
+            {
+                singleQuoted = !singleQuoted;
+            }
+            else if (*p == '\\' && singleQuoted == 0 && p[1] != '\0')
+            {
+                p++;
+            }
+            p++;
+        }
+        appendExpansion(&result, start, p - start, 1);
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        // Finds the line the reference names
+        const char *reference = p++;
+        size_t n = 0;
+        size_t count = historyCount();
+        if (*p == '!')
+        {
+            n = count;
+            p++;
+        }
+        else if (isdigit((unsigned char)*p) || (*p == '-' && isdigit((unsigned char)p[1])))
+        {
+            char *end;
+            long number = strtol(p, &end, 10);
+            p = end;
+            n = number < 0 ? (-number <= (long)count ? count + 1 + number : 0) : (size_t)number;
+        }
+        else if (*p == '?')
+        {
+            const char *end = strchr(p + 1, '?');
+            size_t length = end != NULL ? (size_t)(end - p - 1) : strcspn(p + 1, "\n");
+            n = findHistorySubstring(p + 1, length);
+            p += 1 + length + (end != NULL);
+        }
+        else
+        {
+            // An empty prefix names no line (it would match every one)
+            size_t length = strcspn(p, " \t\n;&|<>");
+            n = length != 0 ? findHistoryPrefix(p, length) : 0;
+            p += length;
+        }
+        if (n == 0 || n > count)
+        {
+            printf("%.*s: event not found\n", (int)(p - reference), reference);
+            fflush(stdout);
+            return NULL;
+        }
+        struct historyEntry *entry = historyLine(n);
+        appendExpansion(&result, entry->text, entry->length, 1);
+        replaced = 1;
+    }
+    if (replaced == 0)
+    {
+        return line;
+    }
+    result.data[result.length] = '\0';
+
+    // Shows the command that will run, like other shells
+    printf("%s\n", result.data);
+    fflush(stdout);
+    return result.data;
+};
+
+// Built-in history command: history [n] lists the history (its last n lines)
+void historyCommand(struct command *cmd)
+{
+    size_t count = historyCount();
+    size_t first = 1;
+    if (cmd->argCount != 0)
+    {
+        char *end;
+        long last = strtol(cmd->arguments[0], &end, 10);
+        if (*end != '\0' || last < 0)
+        {
+            printf("history: %s: numeric argument required\n", cmd->arguments[0]);
+            fflush(stdout);
+            return;
+        }
+        first = (size_t)last < count ? count - last + 1 : 1;
+    }
+    size_t n;
+    for (n = first; n <= count; n++)
+    {
+        struct historyEntry *entry = historyLine(n);
+        printf("%5zu  %.*s\n", n, (int)entry->length, entry->text);
+    }
+    fflush(stdout);
+};
+
+// Returns a copy of word in the line arena with every {} replaced by item
+char *substituteItem(char *word, char *item)
+{
+    int itemLength = strlen(item);
+    int length = 0;
+    char *p;
+    for (p = word; *p != '\0'; p++)
+    {
+        if (p[0] == '{' && p[1] == '}')
+        {
+            length += itemLength;
+            p++;
+        }
+        else
+        {
+            length += 1;
+        }
+    }
+
+    char *result = arenaAlloc(&lineArena, length + 1);
+    char *insert_point = result;
+    for (p = word; *p != '\0'; p++)
+    {
+        if (p[0] == '{' && p[1] == '}')
+        {
+            memcpy(insert_point, item, itemLength);
+            insert_point += itemLength;
+            p++;
+        }
+        else
+        {
+            *insert_point++ = *p;
+        }
+    }
+    *insert_point = '\0';
+    return result;
+};
+
+// Built-in parallel command: parallel [-j N] command [args] [::: items...]
+// Runs the command once per item, from the ::: list or else one per line of the < file (or stdin)
+// Each {} in the command is replaced by the item (the item is appended if there is no {})
+// At most N commands run at once (one in foreground-only mode), each is reported like a background job
+// shellInput is the shell's own input when it reads commands from stdin, so items come from its
+// buffer (which may already hold them) instead of the descriptor, or NULL otherwise
+void parallelCommand(struct command *cmd, struct inputSource *shellInput)
+{
+    int limit = sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 0;
+    int i;
+
+    // Parses the optional concurrency limit
+    if (cmd->argCount >= 1 && strcmp(cmd->arguments[0], "-j") == 0)
+    {
+        char *end = "";
+        limit = cmd->argCount >= 2 ? (int)strtol(cmd->arguments[1], &end, 10) : 0;
+        if (cmd->argCount < 2 || end == cmd->arguments[1] || *end != '\0')
+        {
+            printf("parallel: -j: numeric argument required\n");
+            fflush(stdout);
+            childStatus = W_EXITCODE(2, 0);
+            return;
+        }
+        first = 2;
+    }
+    if (limit < 1 || foregroundMode != 0)
+    {
+        limit = 1;
+    }
+
+    // Template runs from the first word after the options to the ::: separator
+    int separator = first;
+    while (separator < cmd->argCount && strcmp(cmd->arguments[separator], ":::") != 0)
+    {
+        separator += 1;
+    }
+    int templateCount = separator - first;
+    if (templateCount == 0)
+    {
+        printf("parallel: usage: parallel [-j N] command [args] [::: items...]\n");
+        fflush(stdout);
+        return;
+    }
+    int appendItem = 1;
+    for (i = first; i < separator; i++)
+    {
+        if (strstr(cmd->arguments[i], "{}") != NULL)
+        {
+            appendItem = 0;
+        }
+    }
+
+    // Collects the items from the ::: list, or from the input file or stdin one per line
+    char **items;
+    int itemCount = 0;
+    if (separator < cmd->argCount)
+    {
+        items = &cmd->arguments[separator + 1];
+        itemCount = cmd->argCount - separator - 1;
+    }
+    else
+    {
+        struct inputSource itemInput = {0};
+        struct inputSource *source = &itemInput;
+        itemInput.fd = STDIN_FILENO;
+        char *inputFile = NULL;
+        struct redirection *redirect;
+        for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+        {
+            if (redirect->type == REDIRECT_INPUT && redirect->fd == STDIN_FILENO)
+            {
+                inputFile = redirect->fileName;
+            }
+        }
+        if (inputFile != NULL && openScript(&itemInput, inputFile) == -1)
+        {
+            childStatus = W_EXITCODE(1, 0);
+            return;
+        }
+        if (inputFile == NULL && shellInput != NULL)
+        {
+            source = shellInput;
+        }
+        int itemCapacity = 64;
+        items = malloc(itemCapacity * sizeof(char *));
+        size_t len;
+        char *line;
+        while ((line = readLine(source, &len)) != NULL)
+        {
+            if (line[len - 1] == '\n')
+            {
+                len -= 1;
+            }
+            if (itemCount == itemCapacity)
+            {
+                itemCapacity *= 2;
+                items = realloc(items, itemCapacity * sizeof(char *));
+            }
+            items[itemCount++] = arenaStrndup(&lineArena, line, len);
+        }
+        if (itemInput.mapped != 0)
+        {
+            munmap(itemInput.data, itemInput.length);
+        }
+        else
+        {
+            free(itemInput.data);
+        }
+    }
+
+    // Starts commands while slots are free, then waits for one to finish and refills its slot
+    parallelPids = calloc(limit, sizeof(pid_t));
+    parallelInterrupted = 0;
+    parallelLimit = limit;
+    int next = 0;
+    int running = 0;
+    int failed = 0;
+    while (running > 0 || (next < itemCount && parallelInterrupted == 0))
+    {
+        while (running < limit && next < itemCount && parallelInterrupted == 0)
+        {
+            // Builds the command for the next item in the line arena
+            struct command itemCommand = {0};
+            itemCommand.argCount = templateCount - 1 + appendItem;
+            itemCommand.argv = arenaAlloc(&lineArena, (itemCommand.argCount + 2) * sizeof(char *));
+            itemCommand.argv[itemCommand.argCount + 1] = NULL;
+            itemCommand.arguments = itemCommand.argv + 1;
+            itemCommand.name = substituteItem(cmd->arguments[first], items[next]);
+            itemCommand.argv[0] = itemCommand.name;
+            int commandLength = strlen(itemCommand.name) + 1;
+            for (i = 1; i < templateCount; i++)
+            {
+                itemCommand.arguments[i - 1] = substituteItem(cmd->arguments[first + i], items[next]);
+                commandLength += strlen(itemCommand.arguments[i - 1]) + 1;
+            }
+            if (appendItem != 0)
+            {
+                itemCommand.arguments[templateCount - 1] = items[next];
+                commandLength += strlen(items[next]) + 1;
+            }
+
+            // Keeps the command text for job listings and completion messages
+            char *commandLine = arenaAlloc(&lineArena, commandLength);
+            strcpy(commandLine, itemCommand.name);
+            for (i = 0; i < itemCommand.argCount; i++)
+            {
+                strcat(commandLine, " ");
+                strcat(commandLine, itemCommand.arguments[i]);
+            }
+
+            // Launches the command in its own process group and tracks it as a job
+            pid_t spawnpid = spawnCommand(&itemCommand, -1, -1, 0);
+            if (spawnpid == -1)
+            {
+                failed += 1;
+            }
+            else
+            {
+                for (i = 0; parallelPids[i] != 0; i++)
+                {
+                }
+                parallelPids[i] = spawnpid;
+                running += 1;
+                addJob(createJob(spawnpid, &spawnpid, 1, commandLine));
+            }
+            next += 1;
+        }
+        if (running == 0)
+        {
+            break;
+        }
+
+        // Waits for any child, so background jobs finishing meanwhile are reported as well
+        // (captured output of background jobs is read meanwhile, as in waitForeground)
+        int waitStatus;
+        struct rusage usage;
+        pid_t donePid = wait4(-1, &waitStatus, activeLogs != 0 ? WNOHANG : 0, &usage);
+        if (donePid == 0)
+        {
+            waitForOutput();
+            continue;
+        }
+        if (donePid == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (i = 0; i < limit; i++)
+        {
+            if (parallelPids[i] == donePid)
+            {
+                parallelPids[i] = 0;
+                running -= 1;
+                if (waitStatus != 0)
+                {
+                    failed += 1;
+                }
+            }
+        }
+        updateJob(donePid, waitStatus, &usage);
+    }
+    parallelLimit = 0;
+    free(parallelPids);
+    parallelPids = NULL;
+
+    if (separator == cmd->argCount)
+    {
+        free(items);
+    }
+
+    // Status is the number of failed commands (capped at 101, as in GNU parallel)
+    childStatus = W_EXITCODE(failed > 101 ? 101 : failed, 0);
+};
+
+// Parses a value of the limit builtin, sizes take a k, m, g or t suffix and unlimited clears the limit
+// Returns the value (0 for unlimited), or -1 if it is not a positive number
+long long parseLimit(char *value, int size)
+{
+    if (strcmp(value, "unlimited") == 0)
+    {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    long long number = strtoll(value, &end, 10);
+    if (size != 0 && end != value && *end != '\0' && end[1] == '\0' && strchr("kmgt", tolower((unsigned char)*end)) != NULL)
+    {
+        // A size the suffix would push past LLONG_MAX is rejected rather than wrapped
+        int shift = 10 * (strchr("kmgt", tolower((unsigned char)*end)) - "kmgt" + 1);
+        if (number > LLONG_MAX >> shift)
+        {
+            return -1;
+        }
+        number <<= shift;
+        end += 1;
+    }
+    if (end == value || *end != '\0' || number <= 0 || errno != 0)
+    {
+        return -1;
+    }
+    return number;
+};
+
+// Prints one line of the limit builtin's listing
+void printLimit(char *description, long long value, char *unit)
+{
+    if (value == 0)
+    {
+        printf("%-20sunlimited\n", description);
+    }
+    else
+    {
+        printf("%-20s%lld%s\n", description, value, unit);
+    }
+};
+
+// Built-in limit command: limit [-m size] [-t seconds] [-n files] [-M size] [-c percent] [command ...]
+// -m, -t and -n are the RLIMIT_AS, RLIMIT_CPU and RLIMIT_NOFILE of every process, -M and -c the
+// memory.max and cpu.max of a cgroup made for the job under SMALLSH_CGROUP (when it is writable)
+// Without a command the limits become the defaults for every job, without arguments they are listed
+// Returns the limits for the command that follows, which becomes the pipeline's first stage, or NULL
+struct jobLimits *limitCommand(struct command *cmd)
+{
+    struct jobLimits *limits = arenaAlloc(&lineArena, sizeof(struct jobLimits));
+    *limits = defaultLimits;
+    int i;
+    if (cmd->argCount == 0)
+    {
+        printLimit("address space (-m)", limits->addressSpace, " bytes");
+        printLimit("cpu time (-t)", limits->cpuSeconds, "s");
+        printLimit("open files (-n)", limits->openFiles, "");
+        printLimit("cgroup memory (-M)", limits->memoryMax, " bytes");
+        printLimit("cgroup cpu (-c)", limits->cpuPercent, "%");
+        fflush(stdout);
+        return NULL;
+    }
+
+    // Options come in pairs of a letter and its value, -- ends them
+    for (i = 0; i < cmd->argCount && cmd->arguments[i][0] == '-'; i += 2)
+    {
+        char *option = cmd->arguments[i];
+        if (strcmp(option, "--") == 0)
+        {
+            i += 1;
+            break;
+        }
+        long long value = -1;
+        if (i + 1 < cmd->argCount && option[1] != '\0' && option[2] == '\0')
+        {
+            value = parseLimit(cmd->arguments[i + 1], option[1] == 'm' || option[1] == 'M');
+        }
+        switch (value == -1 ? '?' : option[1])
+        {
+            case 'm':
+                limits->addressSpace = value;
+                break;
+            case 't':
+                limits->cpuSeconds = value;
+                break;
+            case 'n':
+                limits->openFiles = value;
+                break;
+            case 'M':
+                limits->memoryMax = value;
+                break;
+            case 'c':
+                limits->cpuPercent = value;
+                break;
+            default:
+                printf("limit: usage: limit [-m size] [-t seconds] [-n files] [-M size] [-c percent] [command]\n");
+                fflush(stdout);
+                return NULL;
+        }
+    }
+    if (i >= cmd->argCount)
+    {
+        defaultLimits = *limits;
+        return NULL;
+    }
+
+    // The command after the options takes the place of limit in the first stage
+    cmd->argv += i + 1;
+    cmd->arguments = cmd->argv + 1;
+    cmd->argCount -= i + 1;
+    cmd->name = cmd->argv[0];
+    return limits;
+};
+
+// Prints the message for the current foreground-only mode (async-signal-safe)
+void printModeMessage()
+{
+    if (foregroundMode != 0)
+    {
+        char *message = "\nEntering foreground-only mode (& is now ignored)\n";
+        write(STDOUT_FILENO, message, 50);
+    }
+    else
+    {
+        char *message = "\nExiting foreground-only mode\n";
+        write(STDOUT_FILENO, message, 30);
+    }
+};
+
+// Signal handler for SIGINT
+void handle_SIGINT(int signo)
+{
+    // Parent process ignores SIGINT, but forwards it to the foreground process group
+    // (without job control children share smallsh's group and get the terminal's SIGINT themselves)
+    if (foregroundHelper > 0 && jobControl != 0)
+    {
+        kill(-foregroundHelper, SIGINT);
+    }
+
+    // and to every command started by the parallel builtin, which then stops starting new ones
+    if (parallelLimit > 0)
+    {
+        int i;
+        for (i = 0; i < parallelLimit; i++)
+        {
+            if (parallelPids[i] > 0 && jobControl != 0)
+            {
+                kill(-parallelPids[i], SIGINT);
+            }
+        }
+        parallelInterrupted = 1;
+    }
+};
+
+// Signal handler for SIGCHLD
+void handle_SIGCHLD(int signo)
+{
+    // Flags the exit and wakes up the main loop, reaping is done outside the handler
+    int savedErrno = errno;
+    childExited = 1;
+    write(reapPipe[1], "", 1);
+    errno = savedErrno;
+};
+
+// Signal handler for SIGTSTP
+void handle_SIGTSTP(int signo)
+{
+    // Program switches between foreground-only mode and normal running mode
+    foregroundMode = !foregroundMode;
+
+    // If there is a foreground process currently running, the message waits for it to terminate
+    if (foregroundHelper != 0)
+    {
+        modeMessagePending = 1;
+    }
+    // Else, print informative message immediately
+    else
+    {
+        printModeMessage();
+        if (interactiveMode != 0)
+        {
+            char *message2 = ": ";
+            write(STDOUT_FILENO, message2, 2);
+        }
+    }
+};
+
+// Descriptor moved out of the way while an in-process builtin's redirections are in effect
+struct savedDescriptor
+{
+    int fd;  // Descriptor of the shell that was redirected
+    int copy;  // Duplicate of its original open file (-1 if it was not open)
+};
+
+// Applies a command's redirections to the shell itself, saving every descriptor they replace
+// Returns the number of saved descriptors for restoreDescriptors, or -1 if a file could not be opened
+int redirectDescriptors(struct command *cmd, struct savedDescriptor *saved)
+{
+    int savedCount = 0;
+    int i;
+    struct redirection *redirect;
+    if (openRedirections(cmd) == -1)
+    {
+        return -1;
+    }
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        // Keeps only the first copy of a descriptor, that is the one to restore
+        for (i = 0; i < savedCount; i++)
+        {
+            if (saved[i].fd == redirect->fd)
+            {
+                break;
+            }
+        }
+        if (i == savedCount)
+        {
+            fflush(NULL);
+            saved[savedCount].fd = redirect->fd;
+            saved[savedCount].copy = fcntl(redirect->fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+            savedCount += 1;
+        }
+
+        if (redirect->type == REDIRECT_CLOSE)
+        {
+            close(redirect->fd);
+        }
+        else if (dup2(redirect->sourceFd, redirect->fd) == -1)
+        {
+            printf("%d: %s\n", redirect->sourceFd, strerror(errno));
+            fflush(stdout);
+        }
+    }
+    closeRedirections(cmd);
+    return savedCount;
+};
+
+// Puts back the descriptors replaced by redirectDescriptors, last one first
+void restoreDescriptors(struct savedDescriptor *saved, int savedCount)
+{
+    fflush(NULL);
+    while (savedCount > 0)
+    {
+        savedCount -= 1;
+        if (saved[savedCount].copy == -1)
+        {
+            close(saved[savedCount].fd);
+        }
+        else
+        {
+            dup2(saved[savedCount].copy, saved[savedCount].fd);
+            close(saved[savedCount].copy);
+        }
+    }
+    clearerr(stdout);
+};
+
+// Writes str to stdout with backslash escapes replaced (\n, \t, \0nnn...)
+// Returns 1 if a \c was found, which ends all output
+int printEscaped(const char *str)
+{
+    const char *p;
+    for (p = str; *p != '\0'; p++)
+    {
+        if (*p != '\\' || p[1] == '\0')
+        {
+            putchar(*p);
+            continue;
+        }
+        p++;
+        switch (*p)
+        {
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'c': return 1;
+            case 'e': putchar('\033'); break;
+            case 'f': putchar('\f'); break;
+            case 'n': putchar('\n'); break;
+            case 'r': putchar('\r'); break;
+            case 't': putchar('\t'); break;
+            case 'v': putchar('\v'); break;
+            case '\\': putchar('\\'); break;
+            default:
+                // Octal byte, \0nnn or \nnn
+                if (*p >= '0' && *p <= '7')
+                {
+                    int value = 0;
+                    int digits = *p == '0' ? 4 : 3;
+                    while (digits-- > 0 && *p >= '0' && *p <= '7')
+                    {
+                        value = value * 8 + (*p++ - '0');
+                    }
+                    p--;
+                    putchar(value & 0xff);
+                }
+                else
+                {
+                    putchar('\\');
+                    putchar(*p);
+                }
+                break;
+        }
+    }
+    return 0;
+};
+
+// Built-in echo command: echo [-neE] [string ...]
+int echoBuiltin(struct command *cmd)
+{
+    int newline = 1;
+    int escapes = 0;
+    int first = 0;
+    int i;
+
+    // Options are only taken while every letter of the word is one of n, e and E
+    while (first < cmd->argCount && cmd->arguments[first][0] == '-' && cmd->arguments[first][1] != '\0' &&
+    strspn(cmd->arguments[first] + 1, "neE") == strlen(cmd->arguments[first] + 1))
+    {
+        char *option;
+        for (option = cmd->arguments[first] + 1; *option != '\0'; option++)
+        {
+            if (*option == 'n')
+            {
+                newline = 0;
+            }
+            else
+            {
+                escapes = *option == 'e';
+            }
+        }
+        first++;
+    }
+
+    for (i = first; i < cmd->argCount; i++)
+    {
+        if (i > first)
+        {
+            putchar(' ');
+        }
+        if (escapes == 0)
+        {
+            fputs(cmd->arguments[i], stdout);
+        }
+        else if (printEscaped(cmd->arguments[i]) != 0)
+        {
+            newline = 0;
+            break;
+        }
+    }
+    if (newline != 0)
+    {
+        putchar('\n');
+    }
+    return 0;
+};
+
+// Built-in printf command: printf format [argument ...], the format is reused until the arguments run out
+int printfBuiltin(struct command *cmd)
+{
+    if (cmd->argCount == 0)
+    {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    char *format = cmd->arguments[0];
+    int next = 1;
+    int status = 0;
+    do
+    {
+        const char *p;
+        int consumed = next;
+        for (p = format; *p != '\0'; p++)
+        {
+            // Escapes in the format are replaced like echo -e
+            if (*p == '\\')
+            {
+                char escape[5] = {0};
+                int length = 1;
+                escape[0] = '\\';
+                while (length < 4 && p[length] != '\0' && (length == 1 || (p[length] >= '0' && p[length] <= '7')))
+                {
+                    escape[length] = p[length];
+                    length++;
+                    if (escape[1] < '0' || escape[1] > '7')
+                    {
+                        break;
+                    }
+                }
+                if (printEscaped(escape) != 0)
+                {
+                    return status;
+                }
+                p += length - 1;
+                continue;
+            }
+            if (*p != '%')
+            {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%')
+            {
+                putchar('%');
+                p++;
+                continue;
+            }
+
+            // Copies the conversion's flags, width and precision into a format of its own
+            // (room is left for %, "ll", the conversion and the terminator)
+            char spec[32];
+            size_t specLength = strspn(p + 1, "-+ #0123456789.");
+            if (specLength + 5 > sizeof(spec) || p[specLength + 1] == '\0')
+            {
+                fprintf(stderr, "printf: %s: invalid format\n", p);
+                return 1;
+            }
+            memcpy(spec, p, specLength + 1);
+            char conversion = p[specLength + 1];
+            p += specLength + 1;
+            char *argument = next < cmd->argCount ? cmd->arguments[next++] : "";
+            char *end;
+            switch (conversion)
+            {
+                case 'd':
+                case 'i':
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                case 'c':
+                    if (conversion == 'c')
+                    {
+                        spec[specLength + 1] = 'c';
+                        spec[specLength + 2] = '\0';
+                        printf(spec, argument[0]);
+                        break;
+                    }
+                    // Numbers are printed as long long, a leading quote gives a character's value
+                    spec[specLength + 1] = 'l';
+                    spec[specLength + 2] = 'l';
+                    spec[specLength + 3] = conversion;
+                    spec[specLength + 4] = '\0';
+                    long long number = strtoll(argument, &end, 0);
+                    if (argument[0] == '\'' || argument[0] == '"')
+                    {
+                        number = (unsigned char)argument[1];
+                    }
+                    else if (*end != '\0')
+                    {
+                        fprintf(stderr, "printf: %s: invalid number\n", argument);
+                        status = 1;
+                    }
+                    printf(spec, number);
+                    break;
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G':
+                    spec[specLength + 1] = conversion;
+                    spec[specLength + 2] = '\0';
+                    double real = strtod(argument, &end);
+                    if (*end != '\0')
+                    {
+                        fprintf(stderr, "printf: %s: invalid number\n", argument);
+                        status = 1;
+                    }
+                    printf(spec, real);
+                    break;
+                case 's':
+                    spec[specLength + 1] = 's';
+                    spec[specLength + 2] = '\0';
+                    printf(spec, argument);
+                    break;
+                case 'b':
+                    if (printEscaped(argument) != 0)
+                    {
+                        return status;
+                    }
+                    break;
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+                    return 1;
+            }
+        }
+
+        // Stops when a pass of the format takes no arguments, as it would repeat forever
+        if (next == consumed)
+        {
+            break;
+        }
+    } while (next < cmd->argCount);
+    return status;
+};
+
+// Parses an integer operand of test, reporting operands that are not numbers
+int testNumber(char *operand, long long *number)
+{
+    char *end;
+    errno = 0;
+    *number = strtoll(operand, &end, 10);
+    if (operand[0] == '\0' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "test: %s: integer expression expected\n", operand);
+        return -1;
+    }
+    return 0;
+};
+
+// Returns whether a word is one of test's unary operators
+int testUnaryOperator(const char *word)
+{
+    return word[0] == '-' && word[1] != '\0' && word[2] == '\0' && strchr("bcdefghkLnprsStuwxz", word[1]) != NULL;
+};
+
+// Returns whether a word is one of test's binary operators (-a and -o join expressions instead)
+int testBinaryOperator(const char *word)
+{
+    static const char *operators[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+    int i;
+    for (i = 0; i < 12; i++)
+    {
+        if (strcmp(word, operators[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+};
+
+// Evaluates a unary test such as -f file, returns 0 (true), 1 (false) or 2 for an unknown operator
+int testUnary(char *operator, char *operand)
+{
+    struct stat info;
+    if (strcmp(operator, "-n") == 0)
+    {
+        return operand[0] == '\0';
+    }
+    if (strcmp(operator, "-z") == 0)
+    {
+        return operand[0] != '\0';
+    }
+    if (strcmp(operator, "-r") == 0 || strcmp(operator, "-w") == 0 || strcmp(operator, "-x") == 0)
+    {
+        int mode = operator[1] == 'r' ? R_OK : operator[1] == 'w' ? W_OK : X_OK;
+        return access(operand, mode) != 0;
+    }
+    if (strcmp(operator, "-L") == 0 || strcmp(operator, "-h") == 0)
+    {
+        return lstat(operand, &info) != 0 || S_ISLNK(info.st_mode) == 0;
+    }
+    if (strcmp(operator, "-t") == 0)
+    {
+        long long fd;
+        if (testNumber(operand, &fd) == -1)
+        {
+            return 2;
+        }
+        return isatty((int)fd) == 0;
+    }
+    if (testUnaryOperator(operator) == 0)
+    {
+        fprintf(stderr, "test: %s: unary operator expected\n", operator);
+        return 2;
+    }
+    if (stat(operand, &info) != 0)
+    {
+        return 1;
+    }
+    switch (operator[1])
+    {
+        case 'b': return S_ISBLK(info.st_mode) == 0;
+        case 'c': return S_ISCHR(info.st_mode) == 0;
+        case 'd': return S_ISDIR(info.st_mode) == 0;
+        case 'f': return S_ISREG(info.st_mode) == 0;
+        case 'g': return (info.st_mode & S_ISGID) == 0;
+        case 'k': return (info.st_mode & S_ISVTX) == 0;
+        case 'p': return S_ISFIFO(info.st_mode) == 0;
+        case 's': return info.st_size == 0;
+        case 'S': return S_ISSOCK(info.st_mode) == 0;
+        case 'u': return (info.st_mode & S_ISUID) == 0;
+        default: return 0;
+    }
+};
+
+// Evaluates a binary test such as a = b or 1 -lt 2, returns 0 (true), 1 (false) or 2 on errors
+int testBinary(char *left, char *operator, char *right)
+{
+    if (strcmp(operator, "=") == 0 || strcmp(operator, "==") == 0)
+    {
+        return strcmp(left, right) != 0;
+    }
+    if (strcmp(operator, "!=") == 0)
+    {
+        return strcmp(left, right) == 0;
+    }
+
+    // With three operands -a and -o join two strings, each true when it is not empty
+    if (strcmp(operator, "-a") == 0)
+    {
+        return left[0] == '\0' || right[0] == '\0';
+    }
+    if (strcmp(operator, "-o") == 0)
+    {
+        return left[0] == '\0' && right[0] == '\0';
+    }
+
+    // File comparisons: newer than, older than (a missing file is older than any other), same file
+    if (strcmp(operator, "-nt") == 0 || strcmp(operator, "-ot") == 0 || strcmp(operator, "-ef") == 0)
+    {
+        struct stat leftInfo;
+        struct stat rightInfo;
+        int leftExists = stat(left, &leftInfo) == 0;
+        int rightExists = stat(right, &rightInfo) == 0;
+        if (operator[1] == 'e')
+        {
+            return leftExists == 0 || rightExists == 0 || leftInfo.st_dev != rightInfo.st_dev ||
+                leftInfo.st_ino != rightInfo.st_ino;
+        }
+        if (operator[1] == 'o')
+        {
+            struct stat swapInfo = leftInfo;
+            int swapExists = leftExists;
+            leftInfo = rightInfo;
+            leftExists = rightExists;
+            rightInfo = swapInfo;
+            rightExists = swapExists;
+        }
+        if (leftExists == 0)
+        {
+            return 1;
+        }
+        if (rightExists == 0)
+        {
+            return 0;
+        }
+        return leftInfo.st_mtim.tv_sec < rightInfo.st_mtim.tv_sec ||
+            (leftInfo.st_mtim.tv_sec == rightInfo.st_mtim.tv_sec && leftInfo.st_mtim.tv_nsec <= rightInfo.st_mtim.tv_nsec);
+    }
+    static const char *comparisons[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        if (strcmp(operator, comparisons[i]) == 0)
+        {
+            break;
+        }
+    }
+    long long a;
+    long long b;
+    if (i == 6)
+    {
+        fprintf(stderr, "test: %s: binary operator expected\n", operator);
+        return 2;
+    }
+    if (testNumber(left, &a) == -1 || testNumber(right, &b) == -1)
+    {
+        return 2;
+    }
+    int results[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return results[i] == 0;
+};
+
+// Operands of a test expression with more than four of them, parsed by testOr and the functions below
+struct testParser
+{
+    char **args;
+    int count;
+    int pos;  // Next operand to parse
+    int error;  // Set once the expression turned out to be invalid
+};
+
+int testOr(struct testParser *parser);
+
+// Parses a primary: ( expression ), a unary or binary test, or a string that is true when not empty
+int testPrimary(struct testParser *parser)
+{
+    char **args = parser->args + parser->pos;
+    int left = parser->count - parser->pos;
+    if (left <= 0)
+    {
+        fprintf(stderr, "test: argument expected\n");
+        parser->error = 1;
+        return 2;
+    }
+
+    // A binary operator after the first operand wins, so [ -f = -f ] compares strings
+    if (left >= 3 && testBinaryOperator(args[1]))
+    {
+        parser->pos += 3;
+        return testBinary(args[0], args[1], args[2]);
+    }
+    if (strcmp(args[0], "(") == 0)
+    {
+        parser->pos += 1;
+        int result = testOr(parser);
+        if (parser->pos >= parser->count || strcmp(parser->args[parser->pos], ")") != 0)
+        {
+            if (parser->error == 0)
+            {
+                fprintf(stderr, "test: missing `)'\n");
+            }
+            parser->error = 1;
+            return 2;
+        }
+        parser->pos += 1;
+        return result;
+    }
+    if (left >= 2 && testUnaryOperator(args[0]))
+    {
+        parser->pos += 2;
+        return testUnary(args[0], args[1]);
+    }
+    parser->pos += 1;
+    return args[0][0] == '\0';
+};
+
+// Parses ! primary (each ! negates what follows)
+int testNot(struct testParser *parser)
+{
+    if (parser->pos < parser->count && strcmp(parser->args[parser->pos], "!") == 0)
+    {
+        parser->pos += 1;
+        int result = testNot(parser);
+        return result == 2 ? 2 : !result;
+    }
+    return testPrimary(parser);
+};
+
+// Parses not-expressions joined by -a, which binds tighter than -o
+int testAnd(struct testParser *parser)
+{
+    int result = testNot(parser);
+    while (parser->error == 0 && parser->pos < parser->count && strcmp(parser->args[parser->pos], "-a") == 0)
+    {
+        parser->pos += 1;
+        int right = testNot(parser);
+        result = result == 2 || right == 2 ? 2 : (result != 0 || right != 0);
+    }
+    return result;
+};
+
+// Parses and-expressions joined by -o
+int testOr(struct testParser *parser)
+{
+    int result = testAnd(parser);
+    while (parser->error == 0 && parser->pos < parser->count && strcmp(parser->args[parser->pos], "-o") == 0)
+    {
+        parser->pos += 1;
+        int right = testAnd(parser);
+        result = result == 2 || right == 2 ? 2 : (result != 0 && right != 0);
+    }
+    return result;
+};
+
+// Built-in test and [ commands, decided by the number of operands like POSIX test
+// (longer expressions with !, -a, -o and parentheses go through testOr)
+// Returns 0 if the expression is true, 1 if it is false and 2 on errors
+int testBuiltin(struct command *cmd)
+{
+    char **args = cmd->arguments;
+    int count = cmd->argCount;
+    int negate = 0;
+    int result;
+
+    // [ needs a closing ], which is not an operand
+    if (strcmp(cmd->name, "[") == 0)
+    {
+        if (count == 0 || strcmp(args[count - 1], "]") != 0)
+        {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        count -= 1;
+    }
+
+    // A leading ! negates the rest, unless it is the only operand or the left side of a comparison
+    if (count > 1 && count <= 4 && strcmp(args[0], "!") == 0 && (count != 3 || testBinaryOperator(args[1]) == 0))
+    {
+        negate = 1;
+        args += 1;
+        count -= 1;
+    }
+
+    // ( expression ) of one or two operands is the expression itself
+    if ((count == 3 || count == 4) && strcmp(args[0], "(") == 0 && strcmp(args[count - 1], ")") == 0 &&
+    (count == 4 || testBinaryOperator(args[1]) == 0))
+    {
+        args += 1;
+        count -= 2;
+    }
+    switch (count)
+    {
+        case 0:
+            result = 1;
+            break;
+        case 1:
+            result = args[0][0] == '\0';
+            break;
+        case 2:
+            result = strcmp(args[0], "!") == 0 ? args[1][0] != '\0' : testUnary(args[0], args[1]);
+            break;
+        case 3:
+            result = testBinary(args[0], args[1], args[2]);
+            break;
+        default:
+        {
+            struct testParser parser = {args, count, 0, 0};
+            result = testOr(&parser);
+            if (parser.error == 0 && parser.pos < count)
+            {
+                fprintf(stderr, "test: %s: unexpected operator\n", args[parser.pos]);
+                return 2;
+            }
+            if (parser.error != 0)
+            {
+                return 2;
+            }
+        }
+    }
+    if (result == 2)
+    {
+        return 2;
+    }
+    return negate != 0 ? !result : result;
+};
+
+// Built-in true command
+int trueBuiltin(struct command *cmd)
+{
+    return 0;
+};
+
+// Built-in false command
+int falseBuiltin(struct command *cmd)
+{
+    return 1;
+};
+
+// Built-in pwd command
+int pwdBuiltin(struct command *cmd)
+{
+    char *directory = getcwd(NULL, 0);
+    if (directory == NULL)
+    {
+        perror("pwd");
+        return 1;
+    }
+    puts(directory);
+    free(directory);
+    return 0;
+};
+
+// Prints the output captured from background jobs in joblog mode: joblog lists the captured jobs,
+// joblog %n prints what job n wrote
+int joblogBuiltin(struct command *cmd)
+{
+    struct jobLog *log;
+    drainJobLogs();
+    if (cmd->argCount == 0)
+    {
+        for (log = jobLogs; log != NULL; log = log->next)
+        {
+            printf("[%d]  %s\t%zu bytes\t%s\n", log->number, log->fd != -1 ? "Running" : "Done",
+                log->length + log->dropped, log->commandLine);
+        }
+        return 0;
+    }
+
+    char *spec = cmd->arguments[0];
+    int number = atoi(spec[0] == '%' ? spec + 1 : spec);
+    for (log = jobLogs; log != NULL && log->number != number; log = log->next)
+    {
+    }
+    if (log == NULL)
+    {
+        fprintf(stderr, "joblog: %s: no such job\n", spec);
+        return 1;
+    }
+
+    // Prints the ring buffer in at most two writes, oldest byte first
+    if (log->dropped != 0)
+    {
+        printf("[%zu earlier bytes dropped]\n", log->dropped);
+    }
+    size_t first = JOBLOG_BUFFER_SIZE - log->start < log->length ? JOBLOG_BUFFER_SIZE - log->start : log->length;
+    fwrite(log->buffer + log->start, 1, first, stdout);
+    fwrite(log->buffer, 1, log->length - first, stdout);
+    return 0;
+};
+
+// Utility run inside smallsh instead of being spawned, returns the command's exit value
+struct builtin
+{
+    const char *name;
+    int (*run)(struct command *cmd);
+};
+
+// Perfect hash table of the in-process builtins, indexed by builtinHash (every name has its own slot)
+struct builtin builtinTable[BUILTIN_TABLE_SIZE] = {
+    [0] = {"test", testBuiltin},
+    [1] = {"true", trueBuiltin},
+    [2] = {"printf", printfBuiltin},
+    [5] = {"false", falseBuiltin},
+    [8] = {"[", testBuiltin},
+    [10] = {"pwd", pwdBuiltin},
+    [12] = {"echo", echoBuiltin},
+    [13] = {"joblog", joblogBuiltin}
+};
+
+// Hash of a command name that gives every builtin in builtinTable a distinct slot (length is never 0)
+unsigned int builtinHash(const char *name, size_t length)
+{
+    return (length * 2 + (unsigned char)name[0] + (unsigned char)name[length - 1]) & (BUILTIN_TABLE_SIZE - 1);
+};
+
+// Returns the in-process builtin for a command name, or NULL if the command must be spawned
+struct builtin *findBuiltin(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0)
+    {
+        return NULL;
+    }
+    struct builtin *entry = &builtinTable[builtinHash(name, length)];
+    if (entry->name != NULL && strcmp(entry->name, name) == 0)
+    {
+        return entry;
+    }
+    return NULL;
+};
+
+// Runs an in-process builtin with its redirections applied to the shell's own descriptors
+// Returns the wait status the command would have had as a child
+int runBuiltin(struct builtin *entry, struct command *cmd)
+{
+    struct savedDescriptor *saved = NULL;
+    int savedCount = 0;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    double start = traceFd != -1 ? traceNow() : 0;
+    if (cmd->redirections != NULL)
+    {
+        int redirectionCount = 0;
+        struct redirection *redirect;
+        for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+        {
+            redirectionCount += 1;
+        }
+        saved = arenaAlloc(&lineArena, redirectionCount * sizeof(struct savedDescriptor));
+        savedCount = redirectDescriptors(cmd, saved);
+        if (savedCount == -1)
+        {
+            return W_EXITCODE(1, 0);
+        }
+    }
+
+    // Output lost to a closed or full descriptor fails the command, as it would the utility
+    int exitValue = entry->run(cmd);
+    if (fflush(stdout) == EOF || ferror(stdout))
+    {
+        fprintf(stderr, "%s: write error: %s\n", cmd->name, strerror(errno));
+        exitValue = exitValue == 0 ? 1 : exitValue;
+    }
+    if (saved != NULL)
+    {
+        restoreDescriptors(saved, savedCount);
+    }
+    if (traceFd != -1)
+    {
+        traceBuiltin(cmd, exitValue, start);
+    }
+
+    // In stats mode builtins are recorded like jobs, under their name
+    if (statsMode != 0)
+    {
+        struct timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        recordLatency(cmd->name, (finished.tv_sec - started.tv_sec) * 1000000LL +
+            (finished.tv_nsec - started.tv_nsec) / 1000);
+    }
+    return W_EXITCODE(exitValue, 0);
+};
+
+// Makes a stage's fd a copy of sourceFd, before any redirections it has of its own
+void prependRedirection(struct command *stage, int fd, int sourceFd)
+{
+    struct redirection *capture = arenaAlloc(&lineArena, sizeof(struct redirection));
+    capture->type = REDIRECT_DUPLICATE;
+    capture->fd = fd;
+    capture->fileName = NULL;
+    capture->sourceFd = sourceFd;
+    capture->next = stage->redirections;
+    if (stage->redirections == NULL)
+    {
+        stage->redirectionLink = &capture->next;
+    }
+    stage->redirections = capture;
+};
+
+// Makes the last stage of a pipeline write its output to fd, before any redirections it has of its own
+void captureOutput(struct command *pipeline, int fd)
+{
+    struct command *last = pipeline;
+    while (last->next != NULL)
+    {
+        last = last->next;
+    }
+    prependRedirection(last, STDOUT_FILENO, fd);
+};
+
+// Reads fd until end of file straight into word, growing it in large steps
+void readSubstitution(int fd, struct wordBuffer *word)
+{
+    while (1)
+    {
+        appendExpansion(word, "", 0, SUBSTITUTION_READ_SIZE);
+        ssize_t nread = read(fd, word->data + word->length, word->capacity - word->length);
+        if (nread == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (nread <= 0)
+        {
+            break;
+        }
+        word->length += nread;
+    }
+};
+
+// Runs a command substitution's text and appends its output to word, without its trailing newlines
+// Builtins of the dispatch table run in-process with their output in a memfd, other pipelines are
+// spawned with their last stage writing into a pipe. Assignments do not reach the shell, as in a subshell
+void commandSubstitution(char *text, struct wordBuffer *word)
+{
+    size_t start = word->length;
+    struct commandList *element;
+    if (substitutionsEnabled == 0)
+    {
+        return;
+    }
+    for (element = createCommandList(text); element != NULL; element = nextCommand(element))
+    {
+        struct command *pipeline = element->pipeline;
+        if (pipeline == NULL)
+        {
+            size_t pos = element->start;
+            struct token tok;
+            pipeline = createCommand(text, &pos, &tok, 1);
+            if (pipeline == NULL)
+            {
+                break;
+            }
+        }
+
+        // $(< file) is the contents of the file, read without running anything
+        if (pipeline->name == NULL)
+        {
+            struct redirection *redirect = pipeline->redirections;
+            if (redirect != NULL && redirect->next == NULL && redirect->type == REDIRECT_INPUT &&
+            redirect->fd == STDIN_FILENO)
+            {
+                int fd = open(redirect->fileName, O_RDONLY | O_CLOEXEC);
+                if (fd == -1)
+                {
+                    printf("cannot open %s for input\n", redirect->fileName);
+                    fflush(stdout);
+                    childStatus = W_EXITCODE(1, 0);
+                    continue;
+                }
+                readSubstitution(fd, word);
+                close(fd);
+                childStatus = 0;
+            }
+            continue;
+        }
+
+        struct builtin *entry = findBuiltin(pipeline->name);
+        if (entry != NULL && pipeline->next == NULL)
+        {
+            int memoryFd = memfd_create("smallsh-substitution", MFD_CLOEXEC);
+            if (memoryFd == -1)
+            {
+                perror("memfd_create()");
+                break;
+            }
+            memoryFd = moveDescriptor(memoryFd);
+            captureOutput(pipeline, memoryFd);
+            childStatus = runBuiltin(entry, pipeline);
+            lseek(memoryFd, 0, SEEK_SET);
+            readSubstitution(memoryFd, word);
+            close(memoryFd);
+            continue;
+        }
+
+        // Reads the output while the pipeline runs, then waits for it like a foreground job
+        int outputPipe[2];
+        if (pipe2(outputPipe, O_CLOEXEC) == -1)
+        {
+            perror("pipe()");
+            break;
+        }
+        outputPipe[0] = moveDescriptor(outputPipe[0]);
+        outputPipe[1] = moveDescriptor(outputPipe[1]);
+        captureOutput(pipeline, outputPipe[1]);
+        int stageCount = 0;
+        struct command *stage;
+        for (stage = pipeline; stage != NULL; stage = stage->next)
+        {
+            stageCount += 1;
+        }
+        pid_t *stagePids = arenaAlloc(&lineArena, stageCount * sizeof(pid_t));
+        pid_t pgid = spawnPipeline(pipeline, stagePids);
+        close(outputPipe[1]);
+        struct job *newJob = createJob(pgid, stagePids, stageCount, element->text);
+        if (jobControl != 0 && newJob->running > 0)
+        {
+            tcsetpgrp(STDIN_FILENO, pgid);
+        }
+        readSubstitution(outputPipe[0], word);
+        close(outputPipe[0]);
+        if (waitForeground(newJob) != 0 && WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT)
+        {
+            substitutionInterrupted = 1;
+            break;
+        }
+    }
 
-// Expands the variable $$ in the input string
-void expandVar(char *line, char *newLine)
-{   
-    // Specifies substring ($$) to expand
-    char subStr[] = "$$";
-    int subStrLen = strlen(subStr);
-    
-    // Retrieves PID and converts it to a string
-    int replaceNum = getpid();
-    char replaceStr[2049];
-    sprintf(replaceStr, "%d", replaceNum);
-    int replaceStrLen = strlen(replaceStr);
-    
-    // Buffer used to store new string with expanded variables
-    char buffer[2049];
-    char *insert_point = &buffer[0];
-    const char *ptr = newLine;
-
-    // Loops through input string
-    while (1)
+    // Trailing newlines are removed from the output
+    while (word->length > start && word->data[word->length - 1] == '\n')
+    {
+        word->length -= 1;
+    }
+};
+
+// Execution stage shared by every external command: spawns all stages of a parsed pipeline, then
+// waits for it in the foreground or registers it as a background job
+// Returns 1 if a foreground job finished (its status is stored in childStatus), 0 otherwise
+int executeCommand(struct command *pipeline, char *commandLine)
+{
+    // Launches all pipeline stages, the spawn engine handles redirection and child signal dispositions
+    int stageCount = 0;
+    int finished = 0;
+    struct command *stage;
+    for (stage = pipeline; stage != NULL; stage = stage->next)
     {
-        // Searches for next occurrence of substring
-        const char *p = strstr(ptr, subStr);
+        stageCount += 1;
+    }
+    pid_t *stagePids = arenaAlloc(&lineArena, stageCount * sizeof(pid_t));
 
-        // If no more occurences of substring, copy remaining part of input to buffer
-        if (p == NULL)
+    // In joblog mode a background job's stdout and stderr go to a pipe read into its log
+    int logPipe[2] = {-1, -1};
+    if (pipeline->mode != 0 && joblogMode != 0 && pipe2(logPipe, O_CLOEXEC) == 0)
+    {
+        logPipe[0] = moveDescriptor(logPipe[0]);
+        logPipe[1] = moveDescriptor(logPipe[1]);
+        fcntl(logPipe[0], F_SETFL, O_NONBLOCK);
+        for (stage = pipeline; stage != NULL; stage = stage->next)
         {
-            strcpy(insert_point, ptr);
-            break;
+            prependRedirection(stage, STDERR_FILENO, logPipe[1]);
         }
+        captureOutput(pipeline, logPipe[1]);
+    }
+    char *cgroup = createJobCgroup(pipeline->limits != NULL ? pipeline->limits : &defaultLimits);
+    spawnCgroup = cgroup;
+    pid_t pgid = spawnPipeline(pipeline, stagePids);
+    spawnCgroup = NULL;
+    struct job *newJob = createJob(pgid, stagePids, stageCount, commandLine);
+    newJob->timed = pipeline->timed;
+    if (logPipe[1] != -1)
+    {
+        close(logPipe[1]);
+    }
 
-        // Else, copies part of input string before substring to buffer
-        memcpy(insert_point, ptr, p - ptr);
-        insert_point += p - ptr;
-
-        // Copies PID to buffer
-        memcpy(insert_point, replaceStr, replaceStrLen);
-        insert_point += replaceStrLen;
+    // Jobs with cgroup limits run in a cgroup of their own, which their stages join before exec
+    newJob->cgroup = cgroup;
 
-        // Moves buffer pointer past the copied PID
-        ptr = p + subStrLen;
+    // In stats mode the latency is recorded under the stage names ("a | b" for pipelines)
+    if (statsMode != 0)
+    {
+        size_t length = 0;
+        for (stage = pipeline; stage != NULL; stage = stage->next)
+        {
+            length += strlen(stage->name) + 3;
+        }
+        newJob->statsName = malloc(length);
+        newJob->statsName[0] = '\0';
+        for (stage = pipeline; stage != NULL; stage = stage->next)
+        {
+            strcat(newJob->statsName, stage->name);
+            if (stage->next != NULL)
+            {
+                strcat(newJob->statsName, " | ");
+            }
+        }
     }
 
-    // Copies and returns new string with expanded variable(s)
-    strcpy(newLine, buffer);
+    // Parent process waits for foreground job's termination
+    if (pipeline->mode == 0)
+    {
+        if (waitForeground(newJob) != 0)
+        {
+            // Prints message if foreground child process is terminated by SIGINT
+            if (WIFSIGNALED(childStatus))
+            {
+                printf("terminated by signal %d\n", WTERMSIG(childStatus));
+                fflush(stdout);
+            }
+            finished = 1;
+        }
+
+        // Prints the foreground-only mode change requested while the process was running
+        if (modeMessagePending != 0)
+        {
+            modeMessagePending = 0;
+            printModeMessage();
+        }
+    }
+    // Parent process does not wait for background job's termination
+    else if (newJob->running > 0)
+    {
+        lastBackgroundPid = jobPid(newJob);
+        printf("background pid is %d\n", lastBackgroundPid);
+        fflush(stdout);
+        addJob(newJob);
+        if (logPipe[0] != -1)
+        {
+            newJob->log = createJobLog(newJob->number, commandLine, logPipe[0]);
+        }
+    }
+    else
+    {
+        if (logPipe[0] != -1)
+        {
+            close(logPipe[0]);
+        }
+        freeJob(newJob);
+    }
+    return finished;
 };
 
-// Structure for storing elements of a command
-struct command 
+long cacheHits = 0;  // Commands run by the cached builtin whose output was replayed
+long cacheMisses = 0;  // Commands run by the cached builtin that had to be spawned
+
+// Returns the 64-bit FNV-1a hash of a cache key, which names its entry in the cache directory
+unsigned long long cacheHash(const char *key, size_t length)
 {
-    char *name;
-    char *arguments[513];
-    char *inputFile;
-    char *outputFile;
-    int mode;  // Whether command will run in foreground/background
-    int argCount;
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
 };
 
-// Parses space-delimited string and returns new command structure
-struct command *createCommand(char *line)
+// Appends a file's name and fingerprint (device, inode, size and modification time) to a cache key,
+// so editing the file changes the key without its content being read
+void addFingerprint(struct wordBuffer *key, const char *fileName)
 {
-    // Allocates space for current command structure, initializes pointer to string
-    struct command *currCommand = malloc(sizeof(struct command));
-    char *saveptr;
-
-    // Initializes members (or elements) of the new command structure
-    currCommand->inputFile = NULL;
-    currCommand->outputFile = NULL;
-    currCommand->mode = 0;
-    currCommand->argCount = 0;
+    char fingerprint[96];
+    struct stat fileInfo;
+    if (stat(fileName, &fileInfo) == -1 || !S_ISREG(fileInfo.st_mode))
+    {
+        return;
+    }
+    int length = snprintf(fingerprint, sizeof(fingerprint), "%llx:%llx:%llx:%lld.%09ld",
+        (unsigned long long)fileInfo.st_dev, (unsigned long long)fileInfo.st_ino,
+        (unsigned long long)fileInfo.st_size, (long long)fileInfo.st_mtim.tv_sec, fileInfo.st_mtim.tv_nsec);
+    appendExpansion(key, "file ", 5, 0);
+    appendExpansion(key, fileName, strlen(fileName) + 1, 0);
+    appendExpansion(key, fingerprint, length + 1, 0);
+};
 
-    // Token for command name
-    char *token = strtok_r(line, " ", &saveptr);
-    token[strcspn(token, "\n")] = 0;
-    currCommand->name = calloc(strlen(token) + 1, sizeof(char));
-    strcpy(currCommand->name, token);
+// Builds the cache key of a command: the working directory, the executable, the expanded argv, the
+// variables named in SMALLSH_CACHE_ENV, the redirections and the fingerprints of the files it names
+// Every part ends with a null byte so no two commands give the same key
+void cacheKey(struct command *cmd, struct wordBuffer *key)
+{
+    char directory[PATH_MAX];
+    struct redirection *redirect;
+    int i;
+    if (getcwd(directory, sizeof(directory)) == NULL)
+    {
+        directory[0] = '\0';
+    }
+    appendExpansion(key, directory, strlen(directory) + 1, 0);
+    char *path = resolvePath(cmd->name);
+    if (path != NULL)
+    {
+        appendExpansion(key, path, strlen(path) + 1, 0);
+    }
+    for (i = 0; cmd->argv[i] != NULL; i++)
+    {
+        appendExpansion(key, cmd->argv[i], strlen(cmd->argv[i]) + 1, 0);
+    }
 
-    // Token for optional command components
-    token = strtok_r(NULL, " ", &saveptr);
-    while (token != NULL)
+    // Only the variables chosen in SMALLSH_CACHE_ENV (names separated by colons) are part of the key
+    char *names = getVariable("SMALLSH_CACHE_ENV");
+    char **env = spawnEnvironment(cmd);
+    while (names != NULL && *names != '\0')
     {
-        // Token for input file
-        if (strcmp(token, "<\n") == 0 || strcmp(token, "<\0") == 0)
+        char *end = strchrnul(names, ':');
+        char **entry;
+        for (entry = env; *entry != NULL; entry++)
         {
-            token = strtok_r(NULL, " ", &saveptr);
-            token[strcspn(token, "\n")] = 0;
-            currCommand->inputFile = calloc(strlen(token) + 1, sizeof(char));
-            strcpy(currCommand->inputFile, token);
+            if (strncmp(*entry, names, end - names) == 0 && (*entry)[end - names] == '=')
+            {
+                appendExpansion(key, *entry, strlen(*entry) + 1, 0);
+                break;
+            }
         }
-        // Token for output file
-        else if (strcmp(token, ">\n") == 0 || strcmp(token, ">\0") == 0)
+        names = *end == ':' ? end + 1 : end;
+    }
+
+    // Input files and here-documents change what the command reads
+    for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+    {
+        char operation[32];
+        int length = sprintf(operation, "redirect %d %d %d", redirect->fd, (int)redirect->type, redirect->sourceFd);
+        appendExpansion(key, operation, length + 1, 0);
+        if (redirect->fileName != NULL)
         {
-            token = strtok_r(NULL, " ", &saveptr);
-            token[strcspn(token, "\n")] = 0;
-            currCommand->outputFile = calloc(strlen(token) + 1, sizeof(char));
-            strcpy(currCommand->outputFile, token);
+            appendExpansion(key, redirect->fileName, strlen(redirect->fileName) + 1, 0);
         }
-        // Token for command mode (foreground vs background)
-        else if (strcmp(token, "&\n") == 0 || strcmp(token, "&\0") == 0)
+        if (redirect->type == REDIRECT_INPUT || redirect->type == REDIRECT_READWRITE)
         {
-            token = strtok_r(NULL, " ", &saveptr);
-            if (token == NULL || strcmp(token, "\n") == 0)
-            {
-                // Only parses background commands if foreground-only mode is OFF
-                if (foregroundMode == 0)
-                {
-                    currCommand->mode = 1;
-                }
-                break;
-            }
+            addFingerprint(key, redirect->fileName);
         }
-        // Token for command argument(s)
-        else
+    }
+    for (i = 0; i < cmd->argCount; i++)
+    {
+        addFingerprint(key, cmd->arguments[i]);
+    }
+};
+
+// Returns the cache directory (SMALLSH_CACHE_DIR, or ~/.smallsh_cache), creating it if needed
+// Returns NULL if there is none to use
+char *cacheDirectory()
+{
+    static char defaultPath[PATH_MAX];
+    char *path = getVariable("SMALLSH_CACHE_DIR");
+    if (path == NULL)
+    {
+        char *homeDir = getVariable("HOME");
+        if (homeDir == NULL)
         {
-            if (strcmp(token, "\n") != 0)
-            {
-                token[strcspn(token, "\n")] = 0;
-                currCommand->arguments[currCommand->argCount] = token;
-                currCommand->argCount += 1;
-            }
+            return NULL;
         }
-        token = strtok_r(NULL, " ", &saveptr);
+        snprintf(defaultPath, sizeof(defaultPath), "%s/%s", homeDir, CACHE_DIRECTORY_NAME);
+        path = defaultPath;
     }
-    return currCommand;
+    if (path[0] == '\0' || (mkdir(path, 0700) == -1 && errno != EEXIST))
+    {
+        return NULL;
+    }
+    return path;
 };
 
-// Signal handler for SIGINT
-void handle_SIGINT(int signo)
+// Checks that a cache entry was stored for key, returns the exit value it recorded or -1 if it was not
+int readCacheEntry(int fd, struct wordBuffer *key)
+{
+    char header[CACHE_HEADER_SIZE + 1];
+    int exitValue;
+    size_t keyLength;
+    if (pread(fd, header, CACHE_HEADER_SIZE, 0) != CACHE_HEADER_SIZE)
+    {
+        return -1;
+    }
+    header[CACHE_HEADER_SIZE] = '\0';
+    if (sscanf(header, "smallsh cache %d %zu", &exitValue, &keyLength) != 2 || keyLength != key->length)
+    {
+        return -1;
+    }
+
+    // The whole key is compared, a hash collision only costs a miss
+    char *storedKey = arenaAlloc(&lineArena, keyLength);
+    if (pread(fd, storedKey, keyLength, CACHE_HEADER_SIZE) != (ssize_t)keyLength ||
+    memcmp(storedKey, key->data, keyLength) != 0)
+    {
+        return -1;
+    }
+    return exitValue;
+};
+
+// Writes a cache entry's output to the command's standard output, applying its redirections
+void replayOutput(struct command *cmd, int fd, off_t offset)
 {
-    // Function is empty as parent process ignores SIGINT
+    struct savedDescriptor *saved = NULL;
+    int savedCount = 0;
+    if (cmd->redirections != NULL)
+    {
+        int redirectionCount = 0;
+        struct redirection *redirect;
+        for (redirect = cmd->redirections; redirect != NULL; redirect = redirect->next)
+        {
+            redirectionCount += 1;
+        }
+        saved = arenaAlloc(&lineArena, redirectionCount * sizeof(struct savedDescriptor));
+        savedCount = redirectDescriptors(cmd, saved);
+        if (savedCount == -1)
+        {
+            return;
+        }
+    }
+
+    // Copies in large reads straight between the descriptors, stdio buffers are not involved
+    fflush(stdout);
+    char *buffer = malloc(CACHE_READ_SIZE);
+    ssize_t nread;
+    while ((nread = pread(fd, buffer, CACHE_READ_SIZE, offset)) > 0)
+    {
+        if (write(STDOUT_FILENO, buffer, nread) != nread)
+        {
+            break;
+        }
+        offset += nread;
+    }
+    free(buffer);
+    if (saved != NULL)
+    {
+        restoreDescriptors(saved, savedCount);
+    }
 };
 
-// Signal handler for SIGTSTP
-void handle_SIGTSTP(int signo)
+// Built-in cached command: cached command [args...] replays the output and exit status of an identical
+// earlier run from the cache directory, or runs the command and stores them; cached alone shows the
+// hit and miss counters (cached -r clears them). On a miss the output is shown once the command exits
+// Returns 1 if the command finished (its status is stored in childStatus), 0 if not, or -1 if it must
+// be run as usual (pipelines, background jobs, in-process builtins and unknown commands are not cached)
+int cachedCommand(struct command *cmd, char *commandLine)
 {
-    // If program is not currently in foreground-only mode
-    if (foregroundMode == 0)
+    if (cmd->argCount == 0 || strcmp(cmd->arguments[0], "-r") == 0)
     {
-        // If there is a foreground process currently running, wait for it to terminate first
-        if (foregroundHelper != 0)
+        if (cmd->argCount == 0)
         {
-            foregroundHelper = waitpid(foregroundHelper, &childStatus, 0);
-            foregroundHelper = 0;
-            char *message = "\nEntering foreground-only mode (& is now ignored)\n";
-            write(STDOUT_FILENO, message, 50);
+            printf("cache hits: %ld, misses: %ld\n", cacheHits, cacheMisses);
+            fflush(stdout);
         }
-        // Else, print informative message immediately
         else
         {
-            char *message = "\nEntering foreground-only mode (& is now ignored)\n";
-            write(STDOUT_FILENO, message, 50);
-            char *message2 = ": ";
-            write(STDOUT_FILENO, message2, 2);
+            cacheHits = 0;
+            cacheMisses = 0;
         }
-        // Program switches to foreground-only mode
-        foregroundMode = 1;
+        return 0;
     }
 
-    // If program is currently in foreground-only mode
-    else
+    // The command after cached takes its place in the first stage
+    cmd->argv += 1;
+    cmd->arguments = cmd->argv + 1;
+    cmd->argCount -= 1;
+    cmd->name = cmd->argv[0];
+    char *directory = cacheDirectory();
+    if (cmd->next != NULL || cmd->mode != 0 || findBuiltin(cmd->name) != NULL || directory == NULL ||
+    resolvePath(cmd->name) == NULL)
+    {
+        return -1;
+    }
+
+    // Entries are named after the hash of their key
+    struct wordBuffer key = {NULL, 0, 0};
+    cacheKey(cmd, &key);
+    char entryPath[PATH_MAX];
+    snprintf(entryPath, sizeof(entryPath), "%s/%016llx", directory, cacheHash(key.data, key.length));
+    int entryFd = open(entryPath, O_RDONLY | O_CLOEXEC);
+    if (entryFd != -1)
+    {
+        int exitValue = readCacheEntry(entryFd, &key);
+        if (exitValue != -1)
+        {
+            cacheHits += 1;
+            replayOutput(cmd, entryFd, CACHE_HEADER_SIZE + key.length);
+            close(entryFd);
+            childStatus = W_EXITCODE(exitValue, 0);
+            return 1;
+        }
+        close(entryFd);
+    }
+    cacheMisses += 1;
+
+    // Else, the command writes its output after the header of a new entry
+    char tempPath[PATH_MAX];
+    snprintf(tempPath, sizeof(tempPath), "%s/tmp.XXXXXX", directory);
+    int tempFd = mkostemp(tempPath, O_CLOEXEC);
+    if (tempFd == -1)
+    {
+        return -1;
+    }
+    tempFd = moveDescriptor(tempFd);
+    char header[CACHE_HEADER_SIZE + 1];
+    sprintf(header, "smallsh cache %3d %10zu\n", 0, key.length);
+    if (writeAll(tempFd, header, CACHE_HEADER_SIZE) == -1 || writeAll(tempFd, key.data, key.length) == -1)
+    {
+        unlink(tempPath);
+        close(tempFd);
+        return -1;
+    }
+
+    // The entry stands for the command's standard output: redirections of fd 1 are held back for the
+    // replay, the others apply after the capture so 2>&1 also goes into the entry and none runs twice
+    struct redirection *outputRedirections = NULL;
+    struct redirection **outputLink = &outputRedirections;
+    struct redirection **link = &cmd->redirections;
+    while (*link != NULL)
     {
-        // If there is a foreground process currently running, wait for it to terminate first
-        if (foregroundHelper != 0)
+        struct redirection *redirect = *link;
+        if (redirect->fd == STDOUT_FILENO)
         {
-            foregroundHelper = waitpid(foregroundHelper, &childStatus, 0);
-            foregroundHelper = 0;
-            char *message = "\nExiting foreground-only mode\n";
-            write(STDOUT_FILENO, message, 30);
+            *link = redirect->next;
+            redirect->next = NULL;
+            *outputLink = redirect;
+            outputLink = &redirect->next;
         }
-        // Else, print informative message immediately
         else
         {
-            char *message = "\nExiting foreground-only mode\n";
-            write(STDOUT_FILENO, message, 30);
-            char *message2 = ": ";
-            write(STDOUT_FILENO, message2, 2);
+            link = &redirect->next;
+        }
+    }
+    cmd->redirectionLink = link;
+    prependRedirection(cmd, STDOUT_FILENO, tempFd);
+    int finished = executeCommand(cmd, commandLine);
+    cmd->redirections = outputRedirections;
+    cmd->redirectionLink = outputLink;
+
+    // A stopped command keeps writing to the entry, which is dropped
+    if (finished == 0)
+    {
+        unlink(tempPath);
+        close(tempFd);
+        return 0;
+    }
+
+    // Only commands that exited are stored, the output is then shown as it would have been
+    if (WIFEXITED(childStatus))
+    {
+        sprintf(header, "smallsh cache %3d %10zu\n", WEXITSTATUS(childStatus), key.length);
+        if (pwrite(tempFd, header, CACHE_HEADER_SIZE, 0) != CACHE_HEADER_SIZE || rename(tempPath, entryPath) == -1)
+        {
+            unlink(tempPath);
         }
-        // Program switches to normal running mode
-        foregroundMode = 0;
     }
+    else
+    {
+        unlink(tempPath);
+    }
+    replayOutput(cmd, tempFd, CACHE_HEADER_SIZE + key.length);
+    close(tempFd);
+    return 1;
 };
 
 // Contains logic for smallsh
-void main()
+// Usage: smallsh [script] or smallsh -c command (reads stdin if neither is given)
+int main(int argc, char *argv[])
 {
-    pid_t spawnpid = -5;  // Initializes spawnpid to arbitrary number for comparison later
-    int backgroundStatus;  // Stores the status of background child processes (not used in this program)
-    int backgroundPids[2049] = {0};  // Array containing the PIDs of background child processes
-    int array_size = sizeof(backgroundPids) / sizeof(int);
-    int x = 0;  // Stores number of PIDs in backgroundPids
     int statusTracker = 0;  // Ensures status command works if no foreground command has ran yet
+    int exitValue = -1;  // Exit value requested by the exit command (-1 until exit is run)
+    int i;
+
+    // Selects the input source, prompts are only printed when reading a terminal
+    struct inputSource input = {0};
+    input.fd = STDIN_FILENO;
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+    {
+        input.data = argv[2];
+        input.length = strlen(argv[2]);
+        input.fd = -1;
+    }
+    else if (argc > 1)
+    {
+        if (openScript(&input, argv[1]) == -1)
+        {
+            exit(1);
+        }
+    }
+    else
+    {
+        interactiveMode = isatty(STDIN_FILENO);
+    }
+
+    // Formats $$ once, the shell's PID never changes
+    sprintf(shellPidString, "%d", (int)getpid());
+
+    // Variables start out as the exported environment smallsh was started with
+    importEnvironment();
+    initTrace();
 
     // Initialize a new, empty sigaction struct
     struct sigaction SIGINT_action = {0};
@@ -238,894 +5861,592 @@ void main()
     // Install signal handler for SIGTSTP (CTRL-Z)
     sigaction(SIGTSTP, &SIGTSTP_action, NULL);
 
+    // Interactive sessions get job control and history
+    if (interactiveMode != 0)
+    {
+        initJobControl();
+        initHistory();
+    }
+
+    // Creates the self-pipe used by the SIGCHLD handler to report finished children
+    if (pipe2(reapPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+        perror("pipe()");
+        exit(2);
+    }
+    reapPipe[0] = moveDescriptor(reapPipe[0]);
+    reapPipe[1] = moveDescriptor(reapPipe[1]);
+
+    // Initialize a new, empty sigaction struct
+    struct sigaction SIGCHLD_action = {0};
+    // Register custom signal handler function
+    SIGCHLD_action.sa_handler = handle_SIGCHLD;
+    // Blocks all catchable signals while handle_SIGCHLD is running
+    sigfillset(&SIGCHLD_action.sa_mask);
+    // Allows for automatic restarts, stopped children are only reported with job control
+    SIGCHLD_action.sa_flags = SA_RESTART | (jobControl != 0 ? 0 : SA_NOCLDSTOP);
+    // Install signal handler for SIGCHLD
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
     // Continuously displays smallsh prompt and waits for command
     while (1)
     {
-        // Checks and cleans up any non-completed background processes, displays update message
-        if (x != 0) {
-            int y;
-            int z = 0;
-            // Loops through array of background PIDs, checking for terminated processes
-            for (y = 0; y < array_size; y++)
-            {
-                if (backgroundPids[y] != 0)
-                {
-                    pid_t test;
-                    test = waitpid(backgroundPids[y], &backgroundStatus, WNOHANG);
-                    if (test != 0)
-                    {
-                        if (WIFEXITED(backgroundStatus))
-                        {
-                            printf("background pid %d is done: exit value %d\n", test, WEXITSTATUS(backgroundStatus));
-                            fflush(stdout);
-                        }
-                        else
-                        {
-                            printf("background pid %d is done: terminated by signal %d\n", test, WTERMSIG(backgroundStatus));
-                            fflush(stdout);
-                        }
-                        backgroundPids[y] = 0;
-                        z -= 1;
-                    }
-                }
-            }
-            x += z;
+        // Cleans up background processes that finished since the last check, displays update message
+        if (childExited != 0)
+        {
+            reapJobs(0);
+        }
+
+        // Reads what captured background jobs wrote meanwhile, scripts may not wait for input for a long time
+        if (activeLogs != 0)
+        {
+            drainJobLogs();
         }
 
         // Prints colon symbol for each command line
-        printf(": ");
-        fflush(stdout);
+        if (interactiveMode != 0)
+        {
+            printf(": ");
+            fflush(stdout);
+        }
+
+        // Releases the previous line's parse state
+        arenaReset(&lineArena);
+        hereDocuments = NULL;
 
         // Parses user input, ignoring blank lines or comments
-        char *line = NULL;
         size_t len = 0;
-        ssize_t nread;
-        nread = getline(&line, &len, stdin);
-        if (strlen(line) == 1 || strncmp(line, "#", 1) == 0)
+        char *line = readLine(&input, &len);
+        if (line == NULL)
+        {
+            break;
+        }
+        if ((len == 1 && line[0] == '\n') || line[0] == '#')
         {
             continue;
         }
 
-        // Creates new array used to store input with expanded variables
-        char newLine[2048];
-        strcpy(newLine, line);
-        expandVar(line, newLine);
+        char *commandLine = arenaStrndup(&lineArena, line, line[len - 1] == '\n' ? len - 1 : len);
+
+        // Replaces history references and records the line, in interactive sessions only
+        if (interactiveMode != 0)
+        {
+            commandLine = expandHistory(commandLine);
+            if (commandLine == NULL)
+            {
+                continue;
+            }
+            addHistory(commandLine, strlen(commandLine));
+        }
 
-        // Creates new command structure
-        struct command *newCommand = createCommand(newLine);
+        // Here-document bodies follow the line, they are read before it is parsed
+        if (strstr(commandLine, "<<") != NULL)
+        {
+            readHereDocuments(commandLine, commandLine, &input);
+        }
 
-        // Built-in exit command
-        if (strcmp(newCommand->name, "exit") == 0)
+        // Splits the line into a list of pipelines, checking its syntax
+        substitutionInterrupted = 0;
+        double parseStart = traceFd != -1 ? traceNow() : 0;
+        struct commandList *commandList = createCommandList(commandLine);
+        struct commandList *element;
+        if (traceFd != -1)
+        {
+            traceParse(commandLine, commandList != NULL ? commandList->pipeline : NULL, parseStart);
+        }
+        // Runs the list without returning to the prompt, && and || skip pipelines on the last status
+        for (element = commandList; element != NULL; element = nextCommand(element))
         {
-            // Kills all background child processes
-            int a;
-            for (a = 0; a < array_size; a++)
+            // Creates new command structure, expanding its words now so earlier commands are seen
+            struct command *newCommand = element->pipeline;
+            if (newCommand == NULL)
             {
-                if (backgroundPids[a] != 0)
+                size_t pos = element->start;
+                struct token tok;
+                parseStart = traceFd != -1 ? traceNow() : 0;
+                newCommand = createCommand(commandLine, &pos, &tok, 1);
+                if (traceFd != -1)
                 {
-                    kill(backgroundPids[a], SIGKILL);
+                    traceParse(element->text, newCommand, parseStart);
+                }
+                if (newCommand == NULL)
+                {
+                    break;
                 }
             }
-            // smallsh terminates itself
-            exit(0);
-        }
 
-        // Built-in cd command
-        if (strcmp(newCommand->name, "cd") == 0)
-        {
-            char *homeDir;
+            // Ctrl-C during a command substitution abandons the rest of the line
+            if (substitutionInterrupted != 0)
+            {
+                printf("\n");
+                fflush(stdout);
+                break;
+            }
+
+            // Assignments without a command set shell variables
+            if (newCommand->name == NULL)
+            {
+                for (i = 0; i < newCommand->assignmentCount; i++)
+                {
+                    char *assignment = newCommand->assignments[i];
+                    size_t length = strchr(assignment, '=') - assignment;
+                    setVariable(assignment, length, assignment + length + 1, 0);
+                }
+                continue;
+            }
+
+            // Built-in exit command
+            if (strcmp(newCommand->name, "exit") == 0)
+            {
+                exitValue = 0;
+                break;
+            }
+
+            // Built-in cd command
+            if (strcmp(newCommand->name, "cd") == 0)
+            {
+                char *homeDir;
+
+                // If no arguments, changes directory to path in HOME environment variable
+                if (newCommand->argCount == 0 || 
+                (strcmp(newCommand->arguments[0], "~") == 0))
+                {
+                    homeDir = getVariable("HOME");
+                }
+                // Else, changes directory to custom path specified by the first argument
+                else
+                {
+                    homeDir = newCommand->arguments[0];
+                }
+
+                // Sets the status so && and || can test whether the directory changed
+                if (homeDir == NULL)
+                {
+                    fprintf(stderr, "cd: HOME not set\n");
+                    childStatus = W_EXITCODE(1, 0);
+                }
+                else if (chdir(homeDir) == -1)
+                {
+                    perror("cd");
+                    childStatus = W_EXITCODE(1, 0);
+                }
+                else
+                {
+                    childStatus = 0;
+                }
+                continue;
+            }
+
+            // Built-in status command
+            if (strcmp(newCommand->name, "status") == 0)
+            {
+                // Returns exit status of last foreground process ran by smallsh
+                if (WIFEXITED(childStatus))
+                {
+                    printf("exit value %d\n", WEXITSTATUS(childStatus));
+                    fflush(stdout);
+                    continue;
+                }
+                // Returns terminating signal of last foreground process ran by smallsh
+                else
+                {
+                    // Returns exit value of 0 if no foreground command has been run yet
+                    if (statusTracker == 0)
+                    {
+                        printf("exit value 0\n");
+                        fflush(stdout);
+                        continue;
+                    }
+                    printf("terminated by signal %d\n", WTERMSIG(childStatus));
+                    fflush(stdout);
+                    continue;
+                }
+            }
 
-            // If no arguments, changes directory to path in HOME environment variable
-            if (newCommand->argCount == 0 || 
-            (strcmp(newCommand->arguments[0], "~") == 0) ||
-            (strcmp(newCommand->arguments[0], "$HOME") == 0))
+            // Built-in jobs command, lists background and stopped jobs
+            if (strcmp(newCommand->name, "jobs") == 0)
             {
-                homeDir = getenv("HOME");
-                chdir(homeDir);
+                if (childExited != 0)
+                {
+                    reapJobs(0);
+                }
+                for (i = 0; i < jobCount; i++)
+                {
+                    printf("[%d]  %s\t\t%s\n", jobTable[i]->number,
+                        jobTable[i]->stopped != 0 ? "Stopped" : "Running", jobTable[i]->commandLine);
+                }
+                fflush(stdout);
+                continue;
             }
-            // Else, changes directory to custom path specified by the first argument
-            else
+
+            // Built-in history command, lists previous lines
+            if (strcmp(newCommand->name, "history") == 0)
             {
-                homeDir = newCommand->arguments[0];
-                chdir(homeDir);
+                historyCommand(newCommand);
+                continue;
             }
-            continue;
-        }
 
-        // Built-in status command
-        if (strcmp(newCommand->name, "status") == 0)
-        {
-            // Returns exit status of last foreground process ran by smallsh
-            if (WIFEXITED(childStatus))
+            // Built-in fg command, continues a job in the foreground and waits for it
+            if (strcmp(newCommand->name, "fg") == 0)
             {
-                printf("exit value %d\n", WEXITSTATUS(childStatus));
+                int index = findJobBySpec("fg", newCommand->argCount != 0 ? newCommand->arguments[0] : NULL);
+                if (index == -1)
+                {
+                    continue;
+                }
+                struct job *fgJob = jobTable[index];
+                removeJob(index);
+                printf("%s\n", fgJob->commandLine);
                 fflush(stdout);
+
+                // Restores the job's terminal modes if it was stopped, then wakes it up
+                if (jobControl != 0 && fgJob->stopped != 0)
+                {
+                    tcsetattr(STDIN_FILENO, TCSADRAIN, &fgJob->modes);
+                }
+                fgJob->stopped = 0;
+                signalJob(fgJob, SIGCONT);
+                if (waitForeground(fgJob) != 0)
+                {
+                    if (WIFSIGNALED(childStatus))
+                    {
+                        printf("terminated by signal %d\n", WTERMSIG(childStatus));
+                        fflush(stdout);
+                    }
+                    statusTracker = 1;
+                }
                 continue;
             }
-            // Returns terminating signal of last foreground process ran by smallsh
-            else
+
+            // Built-in bg command, continues a stopped job in the background
+            if (strcmp(newCommand->name, "bg") == 0)
             {
-                // Returns exit value of 0 if no foreground command has been run yet
-                if (statusTracker == 0)
+                int index = findJobBySpec("bg", newCommand->argCount != 0 ? newCommand->arguments[0] : NULL);
+                if (index != -1)
                 {
-                    printf("exit value 0\n");
+                    jobTable[index]->stopped = 0;
+                    signalJob(jobTable[index], SIGCONT);
+                    printf("[%d]  %s &\n", jobTable[index]->number, jobTable[index]->commandLine);
                     fflush(stdout);
-                    continue;
                 }
-                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                fflush(stdout);
                 continue;
             }
-        }
-
-        // "Command-only" commands
-        if (newCommand->argCount == 0 && 
-        newCommand->inputFile == NULL && 
-        newCommand->outputFile == NULL)
-        {
-            // Restructures command into exec() argument
-            char cmd[2049] = "/bin/";
-            strcat(cmd, newCommand->name);
-            char *newcmd[] = {cmd, NULL};
 
-            // Fork a new process
-            pid_t spawnpid = fork();
-            switch(spawnpid)
+            // Built-in wait command, waits for one job (or all jobs) to terminate
+            if (strcmp(newCommand->name, "wait") == 0)
             {
-                // Display error message if unable to fork new process
-                case -1:
-                    perror("fork()\n");
-                    exit(2);
-                    break;
-                // Child process replaces current program with command passed in exec()
-                case 0:
-                    // Background child processes ignore SIGINT
-                    if (newCommand->mode != 0)
+                struct job *waitJob = NULL;
+                if (newCommand->argCount != 0)
+                {
+                    int index = findJobBySpec("wait", newCommand->arguments[0]);
+                    if (index == -1)
                     {
-                        signal(SIGINT, SIG_IGN);
+                        childStatus = W_EXITCODE(127, 0);
+                        continue;
                     }
-                    // All child processes ignore SIGTSTP
-                    signal(SIGTSTP, SIG_IGN);
+                    waitJob = jobTable[index];
+                }
 
-                    execv(newcmd[0], newcmd);
-                    // exec() returns if there is an error
-                    perror(newCommand->name);
-                    exit(1);
-                    break;
-                // Parent process checks if child process is running in the foreground or background
-                default:
-                    // Parent process waits for foreground child process's termination, then continues loop
-                    if (newCommand->mode == 0)
+                // Handles child events until the job leaves the table (or the table is empty)
+                int waitNumber = waitJob != NULL ? waitJob->number : 0;
+                while (jobCount > 0)
+                {
+                    int stillTracked = 0;
+                    for (i = 0; i < jobCount; i++)
                     {
-                        foregroundHelper = spawnpid;
-                        spawnpid = waitpid(spawnpid, &childStatus, 0);
-                        // Prints message if foreground child process is terminated by SIGINT
-                        if (WIFSIGNALED(childStatus))
+                        if (jobTable[i]->number == waitNumber)
                         {
-                            printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                            fflush(stdout);
-                        }
-                        if (statusTracker == 0)
-                        {
-                            statusTracker = 1;
+                            stillTracked = 1;
                         }
-                        foregroundHelper = 0;
+                    }
+                    if (waitNumber != 0 && stillTracked == 0)
+                    {
+                        break;
+                    }
+
+                    // Captured output is read while waiting, so the jobs never block on a full pipe
+                    int waitStatus;
+                    struct rusage usage;
+                    pid_t donePid = wait4(-1, &waitStatus, activeLogs != 0 ? WNOHANG : 0, &usage);
+                    if (donePid == 0)
+                    {
+                        waitForOutput();
                         continue;
                     }
-                    // Parent process does not wait for background child process's termination, immediately continues loop
-                    else
+                    if (donePid == -1)
                     {
-                        printf("background pid is %d\n", spawnpid);
-                        fflush(stdout);
-                        // Child's PID is added to array of background PIDs
-                        int d;
-                        for (d = 0; d < array_size; d++)
+                        if (errno == EINTR)
                         {
-                            if (backgroundPids[d] == 0)
-                            {
-                                backgroundPids[d] = spawnpid;
-                                break;
-                            }
+                            continue;
                         }
-                        x += 1;
-                        spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                        continue;
+                        break;
                     }
-            }
-        }
+                    updateJob(donePid, waitStatus, &usage);
+                }
 
-        // Commands with arguments only
-        if (newCommand->argCount != 0 && 
-        newCommand->inputFile == NULL && 
-        newCommand->outputFile == NULL)
-        {
-            // Restructures command into exec() argument
-            char cmd[2049] = "/bin/";
-            strcat(cmd, newCommand->name);
-            char *newcmd[515] = {NULL};
-            int i;
-            int j = newCommand->argCount;
-            newcmd[0] = cmd;
-            for (i = 0; i < j; i++)
-            {
-                newcmd[i + 1] = newCommand->arguments[i];
+                // Reports the status of the job waited for, or success after waiting for all jobs
+                childStatus = waitNumber != 0 ? lastBackgroundStatus : 0;
+                continue;
             }
-            
-            // Fork a new process
-            pid_t spawnpid = fork();
-            switch(spawnpid)
+
+            // Built-in kill command, signals jobs (%n) or processes
+            if (strcmp(newCommand->name, "kill") == 0)
             {
-                // Display error message if unable to fork new process
-                case -1:
-                    perror("fork()\n");
-                    exit(2);
-                    break;
-                // Child process replaces current program with command passed in exec()
-                case 0:
-                    // Background child processes ignore SIGINT
-                    if (newCommand->mode != 0)
-                    {
-                        signal(SIGINT, SIG_IGN);
-                    }
-                    // All child processes ignore SIGTSTP
-                    signal(SIGTSTP, SIG_IGN);
-                    
-                    execv(newcmd[0], newcmd);
-                    // exec() returns if there is an error
-                    perror(newCommand->name);
-                    exit(1);
-                    break;
-                // Parent process checks if child process is running in the foreground or background
-                default:
-                    // Parent process waits for foreground child process's termination, then continues loop
-                    if (newCommand->mode == 0)
+                int signalNumber = SIGTERM;
+                int first = 0;
+                if (newCommand->argCount > 1 && strcmp(newCommand->arguments[0], "-s") == 0)
+                {
+                    signalNumber = parseSignal(newCommand->arguments[1]);
+                    first = 2;
+                }
+                else if (newCommand->argCount > 0 && newCommand->arguments[0][0] == '-')
+                {
+                    signalNumber = parseSignal(newCommand->arguments[0] + 1);
+                    first = 1;
+                }
+                if (signalNumber == -1 || first >= newCommand->argCount)
+                {
+                    printf("kill: usage: kill [-s sigspec | -sigspec] pid | %%job ...\n");
+                    fflush(stdout);
+                    continue;
+                }
+                for (i = first; i < newCommand->argCount; i++)
+                {
+                    char *target = newCommand->arguments[i];
+                    int result;
+                    if (target[0] == '%')
                     {
-                        foregroundHelper = spawnpid;
-                        spawnpid = waitpid(spawnpid, &childStatus, 0);
-                        // Prints message if foreground child process is terminated by SIGINT
-                        if (WIFSIGNALED(childStatus))
-                        {
-                            printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                            fflush(stdout);
-                        }
-                        if (statusTracker == 0)
+                        int index = findJobBySpec("kill", target);
+                        if (index == -1)
                         {
-                            statusTracker = 1;
+                            continue;
                         }
-                        foregroundHelper = 0;
-                        continue;
+                        result = signalJob(jobTable[index], signalNumber);
                     }
-                    // Parent process does not wait for background child process's termination, immediately continues loop
                     else
                     {
-                        printf("background pid is %d\n", spawnpid);
+                        result = kill(atoi(target), signalNumber);
+                    }
+                    if (result == -1)
+                    {
+                        printf("kill: %s: %s\n", target, strerror(errno));
                         fflush(stdout);
-                        // Child's PID is added to array of background PIDs
-                        int d;
-                        for (d = 0; d < array_size; d++)
-                        {
-                            if (backgroundPids[d] == 0)
-                            {
-                                backgroundPids[d] = spawnpid;
-                                break;
-                            }
-                        }
-                        x += 1;
-                        spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                        continue;
                     }
+                }
+                continue;
             }
-        }
 
-        // Commands with redirection only
-        if (newCommand->argCount == 0 && 
-        (newCommand->inputFile != NULL || 
-        newCommand->outputFile != NULL))
-        {
-            // Restructures command into exec() argument
-            char cmd[2049] = "/bin/";
-            strcat(cmd, newCommand->name);
-            char *newcmd[] = {cmd, NULL};
-
-            // Commands with output file only
-            if (newCommand->inputFile == NULL && newCommand->outputFile != NULL)
+            // Built-in parallel command, runs a command per item with bounded concurrency
+            if (strcmp(newCommand->name, "parallel") == 0)
             {
-                // Creates path of output file
-                int file_descriptor;
-                char outputFilePath[2049] = "./";
-                strcat(outputFilePath, newCommand->outputFile);
+                parallelCommand(newCommand, argc == 1 && interactiveMode == 0 ? &input : NULL);
+                statusTracker = 1;
+                continue;
+            }
 
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+            // Built-in set command, toggles shell options
+            if (strcmp(newCommand->name, "set") == 0)
+            {
+                if (newCommand->argCount == 2 && strcmp(newCommand->arguments[1], "pipefail") == 0 &&
+                (strcmp(newCommand->arguments[0], "-o") == 0 || strcmp(newCommand->arguments[0], "+o") == 0))
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
-
-                        // Attempts to open output file, prints message if fails
-                        file_descriptor = open(outputFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-                        if (file_descriptor == -1)
-                        {
-                            printf("cannot open %s for output\n", newCommand->outputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdout to output file
-                        dup2(file_descriptor, 1);
-
-                        // Redirects stdin to /dev/null if running in background
-                        if (newCommand->mode != 0)
-                        {
-                            int devNull = open("/dev/null", O_WRONLY);
-                            dup2(devNull, 0);
-                        }
-
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
-                        {
-                            printf("background pid is %d\n", spawnpid);
-                            fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
-                        }
+                    pipefailMode = newCommand->arguments[0][0] == '-';
+                }
+                // Records the latency of every job for the stats builtin
+                else if (newCommand->argCount == 2 && strcmp(newCommand->arguments[1], "stats") == 0 &&
+                (strcmp(newCommand->arguments[0], "-o") == 0 || strcmp(newCommand->arguments[0], "+o") == 0))
+                {
+                    statsMode = newCommand->arguments[0][0] == '-';
                 }
+                // Captures the output of background jobs started from now on for the joblog builtin
+                else if (newCommand->argCount == 2 && strcmp(newCommand->arguments[1], "joblog") == 0 &&
+                (strcmp(newCommand->arguments[0], "-o") == 0 || strcmp(newCommand->arguments[0], "+o") == 0))
+                {
+                    joblogMode = newCommand->arguments[0][0] == '-';
+                }
+                // Starts every captured line with the time it was read
+                else if (newCommand->argCount == 2 && strcmp(newCommand->arguments[1], "timestamps") == 0 &&
+                (strcmp(newCommand->arguments[0], "-o") == 0 || strcmp(newCommand->arguments[0], "+o") == 0))
+                {
+                    timestampMode = newCommand->arguments[0][0] == '-';
+                }
+                else
+                {
+                    printf("set: usage: set [-o|+o] pipefail|stats|joblog|timestamps\n");
+                    fflush(stdout);
+                }
+                continue;
             }
 
-            // Commands with input file only
-            if (newCommand->inputFile != NULL && newCommand->outputFile == NULL)
+            // Built-in stats command, displays latency percentiles per command (stats -r clears them)
+            if (strcmp(newCommand->name, "stats") == 0)
             {
-                // Creates path of input file
-                int file_descriptor;
-                char inputFilePath[2049] = "./";
-                strcat(inputFilePath, newCommand->inputFile);
-
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+                if (newCommand->argCount != 0 && strcmp(newCommand->arguments[0], "-r") == 0)
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
-
-                        // Attempts to open input file, prints message if fails
-                        file_descriptor = open(inputFilePath, O_RDONLY, 0777);
-                        if (file_descriptor == -1)
-                        {
-                            printf("cannot open %s for input\n", newCommand->inputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdin to input file
-                        dup2(file_descriptor, 0);
-
-                        // Redirects stdout to /dev/null if running in background
-                        if (newCommand->mode != 0)
-                        {
-                            int devNull = open("/dev/null", O_WRONLY);
-                            dup2(devNull, 1);
-                        }
-
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
-                        {
-                            printf("background pid is %d\n", spawnpid);
-                            fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
-                        }
+                    clearLatencyStats();
+                }
+                else
+                {
+                    printLatencyStats();
                 }
+                continue;
             }
 
-            // Commands with both input and output
-            else
+            // Built-in hash command
+            if (strcmp(newCommand->name, "hash") == 0)
             {
-                // Creates path of input file
-                int input_descriptor;
-                char inputFilePath[2049] = "./";
-                strcat(inputFilePath, newCommand->inputFile);
-
-                // Creates path of output file
-                int output_descriptor;
-                char outputFilePath[2049] = "./";
-                strcat(outputFilePath, newCommand->outputFile);
-
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+                // Forgets all remembered locations
+                if (newCommand->argCount != 0 && strcmp(newCommand->arguments[0], "-r") == 0)
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
-
-                        // Attempts to open input and output file, prints message if fails
-                        input_descriptor = open(inputFilePath, O_RDONLY, 0777);
-                        if (input_descriptor == -1)
-                        {
-                            printf("cannot open %s for input\n", newCommand->inputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        output_descriptor = open(outputFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-                        if (output_descriptor == -1)
-                        {
-                            printf("cannot open %s for output\n", newCommand->outputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdin to input file
-                        dup2(input_descriptor, 0);
-
-                        // Redirects stdout to output file
-                        dup2(output_descriptor, 1);
-
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
+                    clearPathCache();
+                }
+                // Lists remembered locations if no arguments
+                else if (newCommand->argCount == 0)
+                {
+                    printPathCache();
+                }
+                // Else, looks up and remembers each named command
+                else
+                {
+                    for (i = 0; i < newCommand->argCount; i++)
+                    {
+                        if (resolvePath(newCommand->arguments[i]) == NULL)
                         {
-                            printf("background pid is %d\n", spawnpid);
+                            printf("hash: %s: not found\n", newCommand->arguments[i]);
                             fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
                         }
+                    }
                 }
+                continue;
             }
-        }
 
-        // Commands with arguments and redirection
-        if (newCommand->argCount != 0 && 
-        newCommand->inputFile != NULL || 
-        newCommand->outputFile != NULL)
-        {
-            // Restructures command into exec() argument
-            char cmd[2049] = "/bin/";
-            strcat(cmd, newCommand->name);
-            char *newcmd[515] = {NULL};
-            int i;
-            int j = newCommand->argCount;
-            newcmd[0] = cmd;
-            for (i = 0; i < j; i++)
+            // Built-in export command, marks variables for the environment of commands
+            if (strcmp(newCommand->name, "export") == 0)
             {
-                newcmd[i + 1] = newCommand->arguments[i];
+                // Lists exported variables if no arguments
+                if (newCommand->argCount == 0)
+                {
+                    char **env;
+                    for (env = commandEnvironment(); *env != NULL; env++)
+                    {
+                        printf("export %s\n", *env);
+                    }
+                    fflush(stdout);
+                }
+                for (i = 0; i < newCommand->argCount; i++)
+                {
+                    char *argument = newCommand->arguments[i];
+                    size_t length = nameLength(argument);
+                    if (length == 0 || (argument[length] != '\0' && argument[length] != '='))
+                    {
+                        printf("export: `%s': not a valid identifier\n", argument);
+                        fflush(stdout);
+                        continue;
+                    }
+                    setVariable(argument, length, argument[length] == '=' ? argument + length + 1 : NULL, 1);
+                }
+                continue;
             }
 
-            // Commands with output file only
-            if (newCommand->inputFile == NULL && newCommand->outputFile != NULL)
+            // Built-in unset command, removes variables
+            if (strcmp(newCommand->name, "unset") == 0)
             {
-                // Creates path of output file
-                int file_descriptor;
-                char outputFilePath[2049] = "./";
-                strcat(outputFilePath, newCommand->outputFile);
-
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+                for (i = 0; i < newCommand->argCount; i++)
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
-
-                        // Attempts to open output file, prints message if fails
-                        file_descriptor = open(outputFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-                        if (file_descriptor == -1)
-                        {
-                            printf("cannot open %s for output\n", newCommand->outputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdout to output file
-                        dup2(file_descriptor, 1);
-
-                        // Redirects stdin to /dev/null if running in background
-                        if (newCommand->mode != 0)
-                        {
-                            int devNull = open("/dev/null", O_WRONLY);
-                            dup2(devNull, 0);
-                        }
-
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
-                        {
-                            printf("background pid is %d\n", spawnpid);
-                            fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
-                        }
+                    char *argument = newCommand->arguments[i];
+                    if (nameLength(argument) != strlen(argument))
+                    {
+                        printf("unset: `%s': not a valid identifier\n", argument);
+                        fflush(stdout);
+                        continue;
+                    }
+                    unsetVariable(argument);
                 }
+                continue;
             }
 
-            // Commands with input file only
-            if (newCommand->inputFile != NULL && newCommand->outputFile == NULL)
+            // Built-in env command, prints the environment commands get (env with arguments is run as usual)
+            if (strcmp(newCommand->name, "env") == 0 && newCommand->argCount == 0 && newCommand->next == NULL &&
+            newCommand->redirections == NULL)
             {
-                // Creates path of input file
-                int file_descriptor;
-                char inputFilePath[2049] = "./";
-                strcat(inputFilePath, newCommand->inputFile);
-
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+                char **env;
+                for (env = spawnEnvironment(newCommand); *env != NULL; env++)
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
+                    printf("%s\n", *env);
+                }
+                fflush(stdout);
+                continue;
+            }
 
-                        // Attempts to open input file, prints message if fails
-                        file_descriptor = open(inputFilePath, O_RDONLY, 0777);
-                        if (file_descriptor == -1)
-                        {
-                            printf("cannot open %s for input\n", newCommand->inputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdin to input file
-                        dup2(file_descriptor, 0);
-
-                        // Redirects stdout to /dev/null if running in background
-                        if (newCommand->mode != 0)
-                        {
-                            int devNull = open("/dev/null", O_WRONLY);
-                            dup2(devNull, 1);
-                        }
+            // Built-in limit command, sets limits for every job or runs the command after it with its own
+            if (strcmp(newCommand->name, "limit") == 0)
+            {
+                struct jobLimits *limits = limitCommand(newCommand);
+                if (limits == NULL)
+                {
+                    continue;
+                }
+                struct command *stage;
+                for (stage = newCommand; stage != NULL; stage = stage->next)
+                {
+                    stage->limits = limits;
+                }
+            }
 
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
-                        {
-                            printf("background pid is %d\n", spawnpid);
-                            fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
-                        }
+            // Built-in cached command, replays the output of an identical earlier run or records this one
+            if (strcmp(newCommand->name, "cached") == 0)
+            {
+                int result = cachedCommand(newCommand, element->text);
+                if (result == 1)
+                {
+                    statusTracker = 1;
+                }
+                if (result != -1)
+                {
+                    continue;
                 }
             }
 
-            // Commands with both input and output
-            else
+            // Cheap utilities run inside smallsh when they are a whole foreground pipeline of their own
+            // (commands run under limit are spawned so the limits apply)
+            struct builtin *entry = findBuiltin(newCommand->name);
+            if (entry != NULL && newCommand->next == NULL && newCommand->mode == 0 && newCommand->timed == 0 &&
+            newCommand->limits == NULL)
             {
-                // Creates path of input file
-                int input_descriptor;
-                char inputFilePath[2049] = "./";
-                strcat(inputFilePath, newCommand->inputFile);
+                childStatus = runBuiltin(entry, newCommand);
+                continue;
+            }
 
-                // Creates path of output file
-                int output_descriptor;
-                char outputFilePath[2049] = "./";
-                strcat(outputFilePath, newCommand->outputFile);
+            // Runs the pipeline, in the foreground or as a background job
+            if (executeCommand(newCommand, element->text) != 0)
+            {
+                statusTracker = 1;
 
-                // Fork a new process
-                pid_t spawnpid = fork();
-                switch(spawnpid)
+                // A pipeline killed by SIGINT ends the rest of the list, like in other shells
+                if (WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT)
                 {
-                    // Display error message if unable to fork new process
-                    case -1:
-                        perror("fork()\n");
-                        exit(2);
-                        break;
-                    // Child process replaces current program with command passed in exec()
-                    case 0:
-                        // Background child processes ignore SIGINT
-                        if (newCommand->mode != 0)
-                        {
-                            signal(SIGINT, SIG_IGN);
-                        }
-                        // All child processes ignore SIGTSTP
-                        signal(SIGTSTP, SIG_IGN);
-
-                        // Attempts to open input and output file, prints message if fails
-                        input_descriptor = open(inputFilePath, O_RDONLY, 0777);
-                        if (input_descriptor == -1)
-                        {
-                            printf("cannot open %s for input\n", newCommand->inputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        output_descriptor = open(outputFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-                        if (output_descriptor == -1)
-                        {
-                            printf("cannot open %s for output\n", newCommand->outputFile);
-                            fflush(stdout);
-                            exit(1);
-                            break;
-                        } 
-                        
-                        // Redirects stdin to input file
-                        dup2(input_descriptor, 0);
-
-                        // Redirects stdout to output file
-                        dup2(output_descriptor, 1);
-
-                        execv(newcmd[0], newcmd);
-                        // exec() returns if there is an error
-                        perror(newCommand->name);
-                        exit(1);
-                        break;
-                    // Parent process checks if child process is running in the foreground or background
-                    default:
-                        // Parent process waits for foreground child process's termination, then continues loop
-                        if (newCommand->mode == 0)
-                        {
-                            foregroundHelper = spawnpid;
-                            spawnpid = waitpid(spawnpid, &childStatus, 0);
-                            // Prints message if foreground child process is terminated by SIGINT
-                            if (WIFSIGNALED(childStatus))
-                            {
-                                printf("terminated by signal %d\n", WTERMSIG(childStatus));
-                                fflush(stdout);
-                            }
-                            if (statusTracker == 0)
-                            {
-                                statusTracker = 1;
-                            }
-                            foregroundHelper = 0;
-                            continue;
-                        }
-                        // Parent process does not wait for background child process's termination, immediately continues loop
-                        else
-                        {
-                            printf("background pid is %d\n", spawnpid);
-                            fflush(stdout);
-                            // Child's PID is added to array of background PIDs
-                            int d;
-                            for (d = 0; d < array_size; d++)
-                            {
-                                if (backgroundPids[d] == 0)
-                                {
-                                    backgroundPids[d] = spawnpid;
-                                    break;
-                                }
-                            }
-                            x += 1;
-                            spawnpid = waitpid(spawnpid, &backgroundStatus, WNOHANG);
-                            continue;
-                        }
+                    break;
                 }
             }
         }
+
+        // The exit command ends the list and smallsh
+        if (exitValue != -1)
+        {
+            break;
+        }
+    }
+
+    // Kills all background and stopped jobs
+    for (i = 0; i < jobCount; i++)
+    {
+        signalJob(jobTable[i], SIGKILL);
+    }
+
+    // smallsh terminates itself, at end of input with the last foreground status like other shells
+    if (exitValue == -1)
+    {
+        exitValue = WIFEXITED(childStatus) ? WEXITSTATUS(childStatus) : 128 + WTERMSIG(childStatus);
     }
+    return exitValue;
 };
\ No newline at end of file